@@ -45,6 +45,7 @@ protected:
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
         recorder.clear();
+        recorder.setViewport(0, 0, getWidth(), getHeight());
         recorder.setFillColor(Color::fromRGB(255, 255, 255));
         std::ostringstream ss;
         ss << "FPS: " << fps << "  " << "Screen: " << getWidth() << "x" << getHeight();
@@ -0,0 +1,84 @@
+#include "FontAtlas.h"
+
+#include <chrono>
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+#include "fontpath.hpp"
+
+// Glyph lookup throughput, no window or GL context needed: the atlas texture
+// is only created on its first upload.
+
+struct GlyphKey
+{
+    uint32_t codepoint;
+    uint32_t pixelSize;
+    bool operator==(const GlyphKey &other) const
+    {
+        return codepoint == other.codepoint && pixelSize == other.pixelSize;
+    }
+};
+
+struct GlyphKeyHash
+{
+    size_t operator()(const GlyphKey &key) const
+    {
+        return std::hash<uint32_t>()(key.codepoint) ^ (std::hash<uint32_t>()(key.pixelSize) << 16);
+    }
+};
+
+template <typename Lookup>
+static double measure(const char *name, const std::vector<uint32_t> &text, const size_t *sizes,
+                      size_t sizeCount, size_t rounds, Lookup lookup)
+{
+    long sink = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; ++round)
+        for (size_t s = 0; s < sizeCount; ++s)
+            for (uint32_t ch : text)
+                sink += lookup(ch, sizes[s])->width;
+    const auto end = std::chrono::steady_clock::now();
+    const double ns = std::chrono::duration<double, std::nano>(end - start).count() /
+                      (rounds * sizeCount * text.size());
+    std::printf("%-24s %6.2f ns/glyph (checksum %ld)\n", name, ns, sink);
+    return ns;
+}
+
+int main()
+{
+    const size_t sizes[] = {12, 14, 16, 24, 32};
+    const size_t sizeCount = sizeof(sizes) / sizeof(sizes[0]);
+    const size_t rounds = 2000;
+
+    // Latin text, and text mixing in codepoints beyond the dense range
+    std::vector<uint32_t> latin;
+    for (const char *p = "The quick brown fox jumps over the lazy dog. 0123456789 "
+                         "Sphinx of black quartz, judge my vow! ";
+         *p; ++p)
+        latin.push_back(static_cast<unsigned char>(*p));
+    std::vector<uint32_t> mixed = latin;
+    for (uint32_t ch = 0x100; ch < 0x180; ch += 3)
+        mixed.push_back(ch);
+    for (uint32_t ch = 0x391; ch < 0x3C9; ch += 2)
+        mixed.push_back(ch);
+
+    FontAtlas atlas(std::make_unique<FontFace>(FONT_NotoSerif_PATH));
+    std::unordered_map<GlyphKey, GlyphValue, GlyphKeyHash> map;
+    for (size_t s = 0; s < sizeCount; ++s)
+        for (uint32_t ch : mixed)
+            map[GlyphKey{ch, static_cast<uint32_t>(sizes[s])}] = *atlas.metrics(ch, sizes[s]);
+
+    auto mapLookup = [&map](uint32_t ch, size_t pixelSize)
+    { return &map.find(GlyphKey{ch, static_cast<uint32_t>(pixelSize)})->second; };
+    auto atlasLookup = [&atlas](uint32_t ch, size_t pixelSize)
+    { return atlas.findMetrics(ch, pixelSize); };
+
+    std::printf("%zu glyphs x %zu sizes x %zu rounds\n", latin.size(), sizeCount, rounds);
+    const double latinMap = measure("latin unordered_map", latin, sizes, sizeCount, rounds, mapLookup);
+    const double latinTable = measure("latin GlyphTable", latin, sizes, sizeCount, rounds, atlasLookup);
+    const double mixedMap = measure("mixed unordered_map", mixed, sizes, sizeCount, rounds, mapLookup);
+    const double mixedTable = measure("mixed GlyphTable", mixed, sizes, sizeCount, rounds, atlasLookup);
+    std::printf("speedup latin %.2fx, mixed %.2fx\n", latinMap / latinTable, mixedMap / mixedTable);
+    return 0;
+}
@@ -1,12 +1,49 @@
 #include "Font.h"
 #include "FontAtlas.h"
+#include "FontRegistry.h"
 
 Font::Font(const char *path)
+    : m_data(FontData::fromFile(path))
 {
-    m_atlas = std::make_shared<FontAtlas>(std::make_unique<FontFace>(path));
+    m_atlas = FontRegistry::getInstance().atlas(m_data, m_options);
 }
 
 Font::Font(std::unique_ptr<std::istream> file)
+    : m_data(FontData::fromStream(*file))
 {
-    m_atlas = std::make_shared<FontAtlas>(std::make_unique<FontFace>(std::move(file)));
+    m_atlas = FontRegistry::getInstance().atlas(m_data, m_options);
+}
+
+void Font::setLruEviction(bool enabled)
+{
+    setOption(FontRegistry::OPTION_LRU_EVICTION, enabled);
+}
+
+void Font::setSdf(bool enabled)
+{
+    setOption(FontRegistry::OPTION_SDF, enabled);
+}
+
+void Font::setOption(uint32_t option, bool enabled)
+{
+    const uint32_t options = enabled ? m_options | option : m_options & ~option;
+    if (options == m_options)
+        return;
+    m_options = options;
+    m_atlas = FontRegistry::getInstance().atlas(m_data, m_options);
+}
+
+bool Font::saveSnapshot(const char *path)
+{
+    return m_atlas->saveSnapshot(path);
+}
+
+bool Font::loadSnapshot(const char *path)
+{
+    return m_atlas->loadSnapshot(path);
+}
+
+std::unique_ptr<FontPrewarm> Font::prewarm(std::vector<CodepointRange> ranges, std::vector<size_t> pixelSizes)
+{
+    return std::make_unique<FontPrewarm>(m_atlas, std::move(ranges), std::move(pixelSizes));
 }
@@ -1,13 +1,22 @@
 #ifndef FONT_H
 #define FONT_H
 
+#include "FontPrewarm.h"
+#include <cstdint>
+#include <istream>
 #include <memory>
+#include <vector>
 
 class FontAtlas;
+class FontData;
 
 //
 // Font
 //
+// Fonts of the same file or bytes and mode share their atlas, see FontRegistry.
+// Changing the mode switches to another atlas, recorders use it from their
+// next setFontFamily(). Usable from any thread: the atlas texture is uploaded on
+// commit and deleted by GraphicsRenderer::render() ( FontAtlas::releaseTextures ).
 class Font
 {
 public:
@@ -15,9 +24,27 @@ public:
     Font(std::unique_ptr<std::istream> file);
     ~Font() = default;
 
+    // Keeps recently drawn glyphs when the atlas is full, see FontAtlas::setLruEviction()
+    void setLruEviction(bool enabled);
+    // Draws every pixel size from one distance field per glyph, see FontAtlas::setSdf()
+    void setSdf(bool enabled);
+    // Skips rasterizing on startup, see FontAtlas::saveSnapshot()
+    bool saveSnapshot(const char *path);
+    bool loadSnapshot(const char *path);
+
+    // Rasterizes the glyphs of ranges at every pixel size on a background thread, so
+    // a locale switch or zoom does not pay for them mid-frame. GraphicsRenderer::render()
+    // publishes them a few hundred per frame. Keep the returned prewarm until it
+    // isDone(), destroying it cancels.
+    std::unique_ptr<FontPrewarm> prewarm(std::vector<CodepointRange> ranges, std::vector<size_t> pixelSizes);
+
 private:
+    std::shared_ptr<const FontData> m_data;
+    uint32_t m_options = 0;
     std::shared_ptr<FontAtlas> m_atlas = nullptr;
 
+    void setOption(uint32_t option, bool enabled);
+
     friend class GraphicsRecorder;
 };
 
@@ -1,4 +1,12 @@
 #include "FontAtlas.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <unordered_set>
 
 #include FT_IMAGE_H
 #include FT_OUTLINE_H
@@ -6,58 +14,425 @@
 #include FT_BITMAP_H
 #include FT_BBOX_H
 
+static std::atomic<uint64_t> s_nextAtlasId{1};
+
 FontAtlas::FontAtlas(std::unique_ptr<FontFace> face, size_t atlasSize)
     : m_fontFace(std::move(face)),
       m_atlasSize(std::max(ATLAS_SIZE, atlasSize)),
-      m_atlasBuffer(m_atlasSize, m_atlasSize, 1),
-      m_rectanizer(m_atlasSize, m_atlasSize)
+      m_id(s_nextAtlasId.fetch_add(1, std::memory_order_relaxed))
+{
+    m_texture = createTexture();
+    addPage();
+}
+
+void FontAtlas::setLruEviction(bool enabled)
+{
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    if (m_lruEviction == enabled)
+        return;
+    m_lruEviction = enabled;
+    if (enabled && m_shelfUse == nullptr)
+    {
+        m_shelfUse.reset(new std::atomic<uint32_t>[MAX_PAGES * m_atlasSize]());
+        m_shelfPins.reset(new uint32_t[MAX_PAGES * m_atlasSize]());
+        m_shelfEpochs.reset(new uint32_t[MAX_PAGES * m_atlasSize]());
+    }
+    reset();
+}
+
+void FontAtlas::setSdf(bool enabled)
 {
-    m_texture = std::make_shared<Texture>(getWidth(), getHeight(), Texture::FORMAT_RED, 0, nullptr);
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    if (isSdf() == enabled)
+        return;
+    m_sdf.store(enabled, std::memory_order_relaxed);
+    reset();
+
+    // Metrics differ between modes, runs cached against this atlas must not be reused
+    m_glyphTable.clear();
+    m_currentVersion = 1;
+    m_id = s_nextAtlasId.fetch_add(1, std::memory_order_relaxed);
 }
 
 void FontAtlas::reset()
 {
-    m_atlasBuffer.clear();
+    // Calls may still use the old texture, and any thread may reset: it is brought
+    // up to date by the next syncTexture(), then released on the GL thread
+    m_retiredTextures.push_back(RetiredTexture{std::move(m_texture), m_pages.size(), std::move(m_uploads)});
+    m_uploads.rects.clear();
+    m_uploads.pixels.clear();
+    m_uploads.snapshot.reset();
+    m_pages.resize(1);
+    Page &page = *m_pages.front();
+    page.rectanizer.reset();
+    page.shelves.reset();
+    ++m_generation;
     ++m_currentVersion;
     if (m_currentVersion >= 10)
     {
-        if (m_atlasMap.size() < m_atlasMap.bucket_count() / 2)
-            decltype(m_atlasMap){}.swap(m_atlasMap);
-        else
-            m_atlasMap.clear();
+        m_glyphTable.clear();
         m_currentVersion = 1;
     }
-    m_rectanizer.reset();
-    m_isDirty = false;
-    m_texture = std::make_shared<Texture>(getWidth(), getHeight(), Texture::FORMAT_RED, 0, nullptr);
+    for (std::vector<uint64_t> &keys : m_shelfGlyphs)
+        keys.clear();
+    ++m_pinEpoch;
+    if (m_shelfPins != nullptr)
+        std::fill(m_shelfPins.get(), m_shelfPins.get() + MAX_PAGES * m_atlasSize, 0u);
+    m_texture = createTexture();
+}
+
+void FontAtlas::trim()
+{
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    reset();
+    m_glyphTable = GlyphTable();
+    m_currentVersion = 1;
+    decltype(m_shelfGlyphs){}.swap(m_shelfGlyphs);
+    decltype(m_uploads.pixels){}.swap(m_uploads.pixels);
+    {
+        std::lock_guard<std::mutex> facesLock(m_spareFacesMutex);
+        m_spareFaces.clear();
+    }
+    // Staged glyphs count as dropped
+    std::lock_guard<std::mutex> prewarmLock(m_prewarmMutex);
+    for (PrewarmBatch &batch : m_prewarmBatches)
+        batch.progress->published.fetch_add(batch.codepoints.size() - batch.next, std::memory_order_relaxed);
+    decltype(m_prewarmBatches){}.swap(m_prewarmBatches);
+    m_prewarmStagedBytes = 0;
+    m_prewarmPublished.notify_all();
+}
+
+uint64_t FontAtlas::pinShelves(const std::vector<int> &shelves)
+{
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    if (m_lruEviction)
+        for (int shelf : shelves)
+            if (shelf >= 0)
+                ++m_shelfPins[shelf];
+    return m_pinEpoch;
+}
+
+void FontAtlas::unpinShelves(const std::vector<int> &shelves, uint64_t epoch)
+{
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    if (!m_lruEviction || epoch != m_pinEpoch)
+        return;
+    for (int shelf : shelves)
+        if (shelf >= 0 && m_shelfPins[shelf] > 0)
+            --m_shelfPins[shelf];
+}
+
+void FontAtlas::addPage()
+{
+    m_pages.push_back(std::make_unique<Page>(static_cast<int>(m_atlasSize)));
+}
+
+unsigned char *FontAtlas::queueUpload(int page, int x, int y, int width, int height)
+{
+    const size_t offset = m_uploads.pixels.size();
+    m_uploads.rects.push_back(GlyphUpload{page, x, y, width, height, offset});
+    m_uploads.pixels.resize(offset + static_cast<size_t>(width) * height, 0);
+    return &m_uploads.pixels[offset];
+}
+
+void FontAtlas::uploadGlyphs(Texture &texture, size_t pages, const Uploads &uploads)
+{
+    // New pages grow the array on the GPU, the layers already there are kept
+    texture.setLayers(pages);
+    const size_t pageBytes = static_cast<size_t>(texture.getWidth()) * texture.getHeight();
+    if (uploads.snapshot != nullptr)
+        for (size_t page = 0; page < uploads.snapshotPages; ++page)
+            texture.updateLayer(page, 0, 0, texture.getWidth(), texture.getHeight(),
+                                uploads.snapshot->data() + uploads.snapshotOffset + page * pageBytes);
+    for (const GlyphUpload &rect : uploads.rects)
+        texture.updateLayerRect(rect.page, rect.x, rect.y, rect.width, rect.height, &uploads.pixels[rect.offset]);
+}
+
+void FontAtlas::syncTexture()
+{
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    publishPrewarmed();
+    uploadPending();
+    ++m_frame;
+}
+
+void FontAtlas::uploadPending()
+{
+    for (RetiredTexture &retired : m_retiredTextures)
+        uploadGlyphs(*retired.texture, retired.pages, retired.uploads);
+    m_retiredTextures.clear();
+
+    uploadGlyphs(*m_texture, m_pages.size(), m_uploads);
+    m_uploads.rects.clear();
+    m_uploads.pixels.clear();
+    if (m_uploads.pixels.capacity() > UPLOAD_SCRATCH_BYTES)
+        m_uploads.pixels.shrink_to_fit();
+    m_uploads.snapshot.reset();
+}
+
+// Snapshot file: header, glyphs, then the layout of every page as ints ( skyline
+// then shelves, each after its int count ), then the pixels of every page from
+// pixelOffset. Native byte order, a foreign one fails the magic.
+static constexpr uint32_t SNAPSHOT_MAGIC = 0x414C4754; // "TGLA"
+static constexpr uint32_t SNAPSHOT_VERSION = 1;
+static constexpr uint32_t SNAPSHOT_SDF = 1 << 0;
+static constexpr uint32_t SNAPSHOT_LRU = 1 << 1;
+static constexpr uint64_t SNAPSHOT_PIXEL_ALIGNMENT = 4096;
+
+struct SnapshotHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fontHash;
+    uint32_t atlasSize;
+    uint32_t flags;
+    uint32_t pageCount;
+    uint32_t glyphCount;
+    uint64_t layoutCount;
+    uint64_t pixelOffset;
+};
+
+struct SnapshotGlyph
+{
+    uint32_t codepoint;
+    uint32_t pixelSize;
+    int32_t width, height;
+    int32_t bearingX, bearingY;
+    float advance;
+    int32_t page;
+    int64_t bbox_xMin, bbox_yMin;
+    float textureUV[4];
+    int32_t shelf;
+    uint32_t hasUV;
+};
+
+static_assert(sizeof(SnapshotHeader) == 48 && sizeof(SnapshotGlyph) == 72, "Snapshot layout changed, bump SNAPSHOT_VERSION");
+
+bool FontAtlas::saveSnapshot(const char *path)
+{
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    uploadPending();
+
+    std::vector<SnapshotGlyph> glyphs;
+    glyphs.reserve(m_glyphTable.size());
+    m_glyphTable.forEach([&](uint32_t codepoint, size_t pixelSize, const GlyphValue &value)
+                         {
+                             const bool hasUV = value.versionUV == m_currentVersion;
+                             glyphs.push_back(SnapshotGlyph{codepoint, static_cast<uint32_t>(pixelSize),
+                                                            value.width, value.height, value.bearingX, value.bearingY,
+                                                            value.advance, hasUV ? value.page : 0, value.bbox_xMin, value.bbox_yMin,
+                                                            {value.textureUV.minx, value.textureUV.miny,
+                                                             value.textureUV.maxx, value.textureUV.maxy},
+                                                            hasUV ? value.shelf : -1, hasUV ? 1u : 0u}); });
+
+    std::vector<int32_t> layout;
+    for (const std::unique_ptr<Page> &page : m_pages)
+    {
+        size_t count = layout.size();
+        layout.push_back(0);
+        page->rectanizer.save(layout);
+        layout[count] = static_cast<int32_t>(layout.size() - count - 1);
+        count = layout.size();
+        layout.push_back(0);
+        page->shelves.save(layout);
+        layout[count] = static_cast<int32_t>(layout.size() - count - 1);
+    }
+
+    SnapshotHeader header{};
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.fontHash = m_fontFace->contentHash();
+    header.atlasSize = static_cast<uint32_t>(m_atlasSize);
+    header.flags = (isSdf() ? SNAPSHOT_SDF : 0) | (m_lruEviction ? SNAPSHOT_LRU : 0);
+    header.pageCount = static_cast<uint32_t>(m_pages.size());
+    header.glyphCount = static_cast<uint32_t>(glyphs.size());
+    header.layoutCount = layout.size();
+    const uint64_t dataEnd = sizeof(header) + glyphs.size() * sizeof(SnapshotGlyph) + layout.size() * sizeof(int32_t);
+    header.pixelOffset = (dataEnd + SNAPSHOT_PIXEL_ALIGNMENT - 1) / SNAPSHOT_PIXEL_ALIGNMENT * SNAPSHOT_PIXEL_ALIGNMENT;
+
+    // Written next to the target and renamed over it, so a process mapping the old
+    // file keeps its pages and a crash never leaves a torn snapshot behind
+    const std::string tempPath = std::string(path) + ".tmp";
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(glyphs.data()), glyphs.size() * sizeof(SnapshotGlyph));
+    file.write(reinterpret_cast<const char *>(layout.data()), layout.size() * sizeof(int32_t));
+    const std::vector<char> alignment(header.pixelOffset - dataEnd, 0);
+    file.write(alignment.data(), alignment.size());
+    std::vector<unsigned char> pixels(m_atlasSize * m_atlasSize);
+    for (size_t page = 0; page < m_pages.size(); ++page)
+    {
+        m_texture->readLayer(page, pixels.data());
+        file.write(reinterpret_cast<const char *>(pixels.data()), pixels.size());
+    }
+    file.close();
+    std::error_code error;
+    if (!file.fail())
+        std::filesystem::rename(tempPath, path, error);
+    if (file.fail() || error)
+    {
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+    return true;
+}
+
+bool FontAtlas::loadSnapshot(const char *path)
+{
+    std::unique_ptr<MappedFile> file = std::make_unique<MappedFile>(path);
+    if (!file->isValid() || file->size() < sizeof(SnapshotHeader))
+        return false;
+    SnapshotHeader header;
+    std::memcpy(&header, file->data(), sizeof(header));
+
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    const uint32_t flags = (isSdf() ? SNAPSHOT_SDF : 0) | (m_lruEviction ? SNAPSHOT_LRU : 0);
+    const uint64_t pageBytes = static_cast<uint64_t>(m_atlasSize) * m_atlasSize;
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION || header.atlasSize != m_atlasSize ||
+        header.flags != flags || header.pageCount == 0 || header.pageCount > MAX_PAGES ||
+        header.layoutCount > file->size() ||
+        header.pixelOffset < sizeof(header) + header.glyphCount * sizeof(SnapshotGlyph) + header.layoutCount * sizeof(int32_t) ||
+        header.pixelOffset > file->size() || (file->size() - header.pixelOffset) / pageBytes < header.pageCount ||
+        header.fontHash != m_fontFace->contentHash())
+        return false;
+
+    // Layout first, the atlas is left as is if it is not valid
+    const SnapshotGlyph *glyphs = reinterpret_cast<const SnapshotGlyph *>(file->data() + sizeof(header));
+    const int32_t *layout = reinterpret_cast<const int32_t *>(glyphs + header.glyphCount);
+    const int32_t *layoutEnd = layout + header.layoutCount;
+    std::vector<std::unique_ptr<Page>> pages;
+    for (uint32_t i = 0; i < header.pageCount; ++i)
+    {
+        std::unique_ptr<Page> page = std::make_unique<Page>(static_cast<int>(m_atlasSize));
+        for (int part = 0; part < 2; ++part)
+        {
+            if (layout == layoutEnd || *layout < 0 || *layout > layoutEnd - layout - 1)
+                return false;
+            const size_t count = static_cast<size_t>(*layout++);
+            if (!(part == 0 ? page->rectanizer.load(layout, count) : page->shelves.load(layout, count)))
+                return false;
+            layout += count;
+        }
+        pages.push_back(std::move(page));
+    }
+    // Glyphs without UVs may point to pages dropped by a reset, only placed ones need valid ones
+    const int maxShelf = static_cast<int>(header.pageCount * m_atlasSize);
+    std::unordered_set<uint64_t> keys;
+    keys.reserve(header.glyphCount);
+    for (uint32_t i = 0; i < header.glyphCount; ++i)
+    {
+        const SnapshotGlyph &glyph = glyphs[i];
+        const bool pixelSizeValid = isSdf() ? glyph.pixelSize == SDF_PIXEL_SIZE
+                                            : glyph.pixelSize > 0 && glyph.pixelSize <= maxPixelSize();
+        if (!pixelSizeValid || !keys.insert((static_cast<uint64_t>(glyph.pixelSize) << 32) | glyph.codepoint).second)
+            return false;
+        if (glyph.hasUV && (glyph.page < 0 || glyph.page >= static_cast<int32_t>(header.pageCount) ||
+                            glyph.shelf < -1 || glyph.shelf >= maxShelf))
+            return false;
+    }
+
+    reset();
+    m_glyphTable.clear();
+    m_pages = std::move(pages);
+    for (uint32_t i = 0; i < header.glyphCount; ++i)
+    {
+        const SnapshotGlyph &glyph = glyphs[i];
+        GlyphValue value;
+        value.width = glyph.width;
+        value.height = glyph.height;
+        value.bearingX = glyph.bearingX;
+        value.bearingY = glyph.bearingY;
+        value.advance = glyph.advance;
+        value.bbox_xMin = glyph.bbox_xMin;
+        value.bbox_yMin = glyph.bbox_yMin;
+        value.versionUV = glyph.hasUV ? m_currentVersion : 0;
+        value.textureUV = Bounds{glyph.textureUV[0], glyph.textureUV[1], glyph.textureUV[2], glyph.textureUV[3]};
+        value.page = glyph.hasUV ? glyph.page : 0;
+        value.shelf = m_lruEviction && glyph.hasUV ? glyph.shelf : -1;
+        m_glyphTable.insert(glyph.codepoint, glyph.pixelSize, value);
+        if (value.shelf >= 0)
+        {
+            if (static_cast<size_t>(value.shelf) >= m_shelfGlyphs.size())
+                m_shelfGlyphs.resize(value.shelf + 1);
+            m_shelfGlyphs[value.shelf].push_back((static_cast<uint64_t>(glyph.pixelSize) << 32) | glyph.codepoint);
+            m_shelfUse[value.shelf].store(m_frame, std::memory_order_relaxed);
+        }
+    }
+
+    m_uploads.snapshotOffset = header.pixelOffset;
+    m_uploads.snapshotPages = header.pageCount;
+    m_uploads.snapshot = std::move(file);
+    return true;
+}
+
+// Textures whose last reference was dropped, possibly off the GL thread
+static std::mutex s_releasedMutex;
+static std::vector<Texture *> s_releasedTextures;
+
+std::shared_ptr<Texture> FontAtlas::createTexture() const
+{
+    return std::shared_ptr<Texture>(new Texture(getWidth(), getHeight(), size_t(1), Texture::FORMAT_RED, 0),
+                                    [](Texture *texture)
+                                    {
+                                        std::lock_guard<std::mutex> lock(s_releasedMutex);
+                                        s_releasedTextures.push_back(texture);
+                                    });
+}
+
+void FontAtlas::releaseTextures()
+{
+    std::vector<Texture *> textures;
+    {
+        std::lock_guard<std::mutex> lock(s_releasedMutex);
+        textures.swap(s_releasedTextures);
+    }
+    for (Texture *texture : textures)
+        delete texture;
+}
+
+Bounds FontAtlas::extents(size_t pixelSize) const
+{
+    const FT_Face face = m_fontFace->getFTFace();
+    if (!FT_IS_SCALABLE(face) || face->units_per_EM == 0)
+        return Bounds{-std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(),
+                      +std::numeric_limits<float>::infinity(), +std::numeric_limits<float>::infinity()};
+
+    // Font units are y up, one extra pixel for hinting and rounding
+    const float scale = static_cast<float>(pixelSize) / face->units_per_EM;
+    const float margin = 1.0f + glyphBorder() * static_cast<float>(pixelSize) / glyphPixelSize(pixelSize);
+    return Bounds{face->bbox.xMin * scale - margin, -face->bbox.yMax * scale - margin,
+                  face->bbox.xMax * scale + margin, -face->bbox.yMin * scale + margin};
 }
 
 GlyphValue *FontAtlas::metrics(uint32_t codepoint, size_t pixelSize)
 {
-    GlyphKey key{codepoint, pixelSize};
-    std::unordered_map<GlyphKey, GlyphValue, GlyphKeyHash>::iterator it = m_atlasMap.find(key);
-    if (it != m_atlasMap.end())
-        return &it->second;
+    GlyphValue *item = m_glyphTable.find(codepoint, pixelSize);
+    if (item != nullptr)
+        return item;
     else
     {
         GlyphValue new_item;
         FT_GlyphSlot glyph_slot = loadCharFTGlyphSlot(codepoint, pixelSize);
-        loadCharMetrics(glyph_slot, new_item);
-        return &m_atlasMap.insert(std::make_pair(key, new_item)).first->second;
+        loadCharMetrics(glyph_slot, isSdf(), new_item);
+        return m_glyphTable.insert(codepoint, pixelSize, new_item);
     }
 }
 
 GlyphValue *FontAtlas::glyph(uint32_t codepoint, size_t pixelSize)
 {
-    GlyphKey key{codepoint, pixelSize};
-    std::unordered_map<GlyphKey, GlyphValue, GlyphKeyHash>::iterator it = m_atlasMap.find(key);
-    if (it != m_atlasMap.end())
+    GlyphValue *item = m_glyphTable.find(codepoint, pixelSize);
+    if (item != nullptr)
     {
-        GlyphValue &cur_item = it->second;
+        GlyphValue &cur_item = *item;
         if (cur_item.versionUV == m_currentVersion)
+        {
+            touchShelf(cur_item.shelf);
             return &cur_item;
+        }
         FT_GlyphSlot glyph_slot = loadCharFTGlyphSlot(codepoint, pixelSize);
-        if (!loadCharToAtlas(glyph_slot, cur_item))
+        if (!loadCharToAtlas(codepoint, pixelSize, glyph_slot, cur_item))
             return nullptr;
         else
             return &cur_item;
@@ -66,30 +441,46 @@ GlyphValue *FontAtlas::glyph(uint32_t codepoint, size_t pixelSize)
     {
         FT_GlyphSlot glyph_slot = loadCharFTGlyphSlot(codepoint, pixelSize);
         GlyphValue new_item;
-        loadCharMetrics(glyph_slot, new_item);
-        if (!loadCharToAtlas(glyph_slot, new_item))
+        loadCharMetrics(glyph_slot, isSdf(), new_item);
+        if (!loadCharToAtlas(codepoint, pixelSize, glyph_slot, new_item))
             return nullptr;
         else
-            return &m_atlasMap.insert(std::make_pair(key, new_item)).first->second;
+            return m_glyphTable.insert(codepoint, pixelSize, new_item);
     }
 }
 
 FT_GlyphSlot FontAtlas::loadCharFTGlyphSlot(uint32_t codepoint, size_t pixelSize)
 {
-    if (m_pixelSize != pixelSize)
-    {
-        m_pixelSize = pixelSize;
-        m_fontFace->setPixelSize(pixelSize);
-    }
-    m_fontFace->loadChar(codepoint);
+    m_fontFace->setPixelSize(pixelSize);
+    m_fontFace->loadChar(codepoint, loadFlags(isSdf()));
     return m_fontFace->getGlyphSlot();
 }
 
-void FontAtlas::loadCharMetrics(FT_GlyphSlot glyph_slot, GlyphValue &out_item)
+void FontAtlas::loadCharMetrics(FT_GlyphSlot glyph_slot, bool sdf, GlyphValue &out_item)
 {
     FT_BBox bbox;
     if (FT_Outline_Get_BBox(&glyph_slot->outline, &bbox))
         throw std::runtime_error("Freetype error: FT_Outline_Get_BBox");
+    out_item.versionUV = 0;
+    out_item.page = 0;
+    out_item.shelf = -1;
+    if (sdf)
+    {
+        // Box on the pixel grid and unrounded advance, exact once scaled
+        const FT_Pos left = bbox.xMin & ~63;
+        const FT_Pos bottom = bbox.yMin & ~63;
+        const FT_Pos right = (bbox.xMax + 63) & ~63;
+        const FT_Pos top = (bbox.yMax + 63) & ~63;
+        out_item.width = std::max(static_cast<int>((right - left) >> 6), 1);
+        out_item.height = std::max(static_cast<int>((top - bottom) >> 6), 1);
+        out_item.bearingX = static_cast<int>(left >> 6);
+        out_item.bearingY = static_cast<int>(top >> 6);
+        out_item.advance = static_cast<float>(glyph_slot->linearHoriAdvance) / 65536.0f;
+        out_item.bbox_xMin = left;
+        out_item.bbox_yMin = bottom;
+        return;
+    }
+
     int char_width = std::max(static_cast<int>((bbox.xMax - bbox.xMin + 63) >> 6), 1);
     int char_height = std::max(static_cast<int>((bbox.yMax - bbox.yMin + 63) >> 6), 1);
 
@@ -100,10 +491,9 @@ void FontAtlas::loadCharMetrics(FT_GlyphSlot glyph_slot, GlyphValue &out_item)
     out_item.advance = static_cast<float>(glyph_slot->advance.x) / 64.0f;
     out_item.bbox_xMin = bbox.xMin;
     out_item.bbox_yMin = bbox.yMin;
-    out_item.versionUV = 0;
 }
 
-bool FontAtlas::loadCharToAtlas(FT_GlyphSlot glyph_slot, GlyphValue &out_item)
+bool FontAtlas::loadCharToAtlas(uint32_t codepoint, size_t pixelSize, FT_GlyphSlot glyph_slot, GlyphValue &out_item)
 {
     if (glyph_slot->outline.n_points == 0)
     {
@@ -111,13 +501,13 @@ bool FontAtlas::loadCharToAtlas(FT_GlyphSlot glyph_slot, GlyphValue &out_item)
         return true;
     }
 
-    int char_width = out_item.width;
-    int char_height = out_item.height;
+    int char_width = out_item.width + 2 * glyphBorder();
+    int char_height = out_item.height + 2 * glyphBorder();
     int padded_width = char_width + 2 * ATLAS_PADDING;
     int padded_height = char_height + 2 * ATLAS_PADDING;
 
     int pos_x, pos_y;
-    if (!m_rectanizer.addRect(padded_width, padded_height, pos_x, pos_y))
+    if (!allocateRect(codepoint, pixelSize, padded_width, padded_height, pos_x, pos_y, out_item))
     {
         out_item.versionUV = 0;
         return false;
@@ -126,11 +516,31 @@ bool FontAtlas::loadCharToAtlas(FT_GlyphSlot glyph_slot, GlyphValue &out_item)
     int draw_x = pos_x + ATLAS_PADDING;
     int draw_y = pos_y + ATLAS_PADDING;
 
+    unsigned char *pixels = queueUpload(out_item.page, pos_x, pos_y, padded_width, padded_height);
+    pixels += ATLAS_PADDING * padded_width + ATLAS_PADDING;
+    if (isSdf())
+        renderSdf(glyph_slot, out_item, pixels, padded_width);
+    else
+        renderOutline(m_fontFace->getFTLibrary(), glyph_slot, out_item, pixels, padded_width);
+
+    Bounds &textureUV = out_item.textureUV;
+    textureUV.minx = static_cast<float>(draw_x) / getWidth();
+    textureUV.miny = static_cast<float>(draw_y) / getHeight();
+    textureUV.maxx = textureUV.minx + static_cast<float>(char_width) / getWidth();
+    textureUV.maxy = textureUV.miny + static_cast<float>(char_height) / getHeight();
+
+    out_item.versionUV = m_currentVersion;
+    return true;
+}
+
+void FontAtlas::renderOutline(FT_Library library, FT_GlyphSlot glyph_slot, const GlyphValue &item,
+                              unsigned char *buffer, int pitch)
+{
     FT_Bitmap bitmap;
-    bitmap.rows = char_height;
-    bitmap.width = char_width;
-    bitmap.pitch = m_atlasBuffer.rowBytes();
-    bitmap.buffer = &m_atlasBuffer.at<unsigned char>(draw_x, draw_y);
+    bitmap.rows = item.height;
+    bitmap.width = item.width;
+    bitmap.pitch = pitch;
+    bitmap.buffer = buffer;
     bitmap.pixel_mode = FT_PIXEL_MODE_GRAY;
 
     FT_Raster_Params rasterParams;
@@ -138,9 +548,328 @@ bool FontAtlas::loadCharToAtlas(FT_GlyphSlot glyph_slot, GlyphValue &out_item)
     rasterParams.source = &glyph_slot->outline;
     rasterParams.flags = FT_RASTER_FLAG_AA;
 
-    FT_Outline_Translate(&glyph_slot->outline, -out_item.bbox_xMin, -out_item.bbox_yMin);
-    if (FT_Outline_Render(m_fontFace->getFTLibrary(), &glyph_slot->outline, &rasterParams))
+    FT_Outline_Translate(&glyph_slot->outline, -item.bbox_xMin, -item.bbox_yMin);
+    if (FT_Outline_Render(library, &glyph_slot->outline, &rasterParams))
         throw std::runtime_error("Freetype error: FT_Outline_Render");
+}
+
+void FontAtlas::renderSdf(FT_GlyphSlot glyph_slot, const GlyphValue &item, unsigned char *buffer, int pitch)
+{
+    // FreeType spreads the field around the outline's control box, which may be
+    // larger than the metrics box: copy the box grown by the spread, 0 is far outside
+    FT_Outline_Translate(&glyph_slot->outline, -item.bbox_xMin, -item.bbox_yMin);
+    if (FT_Render_Glyph(glyph_slot, FT_RENDER_MODE_SDF))
+        throw std::runtime_error("Freetype error: FT_Render_Glyph");
+    const FT_Bitmap &bitmap = glyph_slot->bitmap;
+    const int width = item.width + 2 * SDF_SPREAD;
+    const int height = item.height + 2 * SDF_SPREAD;
+    const int offsetX = -SDF_SPREAD - glyph_slot->bitmap_left;
+    const int offsetY = glyph_slot->bitmap_top - item.height - SDF_SPREAD;
+    for (int row = 0; row < height; ++row)
+    {
+        const int srcRow = row + offsetY;
+        if (srcRow < 0 || srcRow >= static_cast<int>(bitmap.rows))
+            continue;
+        for (int col = 0; col < width; ++col)
+        {
+            const int srcCol = col + offsetX;
+            if (srcCol >= 0 && srcCol < static_cast<int>(bitmap.width))
+                buffer[row * pitch + col] = bitmap.buffer[srcRow * bitmap.pitch + srcCol];
+        }
+    }
+}
+
+void FontAtlas::prepareGlyphs(const uint32_t *codepoints, size_t count, size_t pixelSize)
+{
+    std::vector<uint32_t> pendingCodepoints;
+    uint64_t id;
+    bool sdf;
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        for (size_t i = 0; i < count; ++i)
+            if (findGlyph(codepoints[i], pixelSize) == nullptr)
+                pendingCodepoints.push_back(codepoints[i]);
+        id = m_id;
+        sdf = isSdf();
+    }
+    std::sort(pendingCodepoints.begin(), pendingCodepoints.end());
+    pendingCodepoints.erase(std::unique(pendingCodepoints.begin(), pendingCodepoints.end()), pendingCodepoints.end());
+    const size_t pendingCount = pendingCodepoints.size();
+
+    // Few glyphs are not worth waking the pool nor holding the lock for long
+    ThreadPool &pool = ThreadPool::getInstance();
+    if (pendingCount < PARALLEL_MIN_GLYPHS || pool.size() == 1)
+    {
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        for (uint32_t codepoint : pendingCodepoints)
+            if (findGlyph(codepoint, pixelSize) == nullptr && glyph(codepoint, pixelSize) == nullptr)
+                break;
+        return;
+    }
+
+    // Rasterize on the pool without the lock, each thread on a face of its own
+    std::vector<std::unique_ptr<FontFace>> faces(pool.size());
+    for (std::unique_ptr<FontFace> &face : faces)
+        face = borrowFace();
+    std::vector<PendingGlyph> pendingGlyphs(pendingCount);
+    pool.run(pendingCount, [&](size_t index, size_t thread)
+             { rasterizePending(*faces[thread], pendingCodepoints[index], pixelSize, sdf, pendingGlyphs[index]); });
+    for (std::unique_ptr<FontFace> &face : faces)
+        returnFace(std::move(face));
+
+    // Pack in order, skipping glyphs other threads packed meanwhile. A mode change
+    // in between made the bitmaps useless.
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    if (m_id != id)
+        return;
+    for (size_t i = 0; i < pendingCount; ++i)
+    {
+        if (findGlyph(pendingCodepoints[i], pixelSize) != nullptr)
+            continue;
+        GlyphValue *item = m_glyphTable.find(pendingCodepoints[i], pixelSize);
+        if (item == nullptr)
+            item = m_glyphTable.insert(pendingCodepoints[i], pixelSize, pendingGlyphs[i].item);
+        if (!packGlyph(pendingCodepoints[i], pixelSize, pendingGlyphs[i], *item))
+            break;
+    }
+}
+
+void FontAtlas::rasterizePending(FontFace &face, uint32_t codepoint, size_t pixelSize, bool sdf, PendingGlyph &pending)
+{
+    face.setPixelSize(pixelSize);
+    face.loadChar(codepoint, loadFlags(sdf));
+    FT_GlyphSlot glyph_slot = face.getGlyphSlot();
+
+    loadCharMetrics(glyph_slot, sdf, pending.item);
+    pending.hasOutline = glyph_slot->outline.n_points != 0;
+    if (!pending.hasOutline)
+        return;
+    const int border = sdf ? SDF_SPREAD : 0;
+    const int padded_width = pending.item.width + 2 * (border + ATLAS_PADDING);
+    const int padded_height = pending.item.height + 2 * (border + ATLAS_PADDING);
+    pending.pixels.assign(static_cast<size_t>(padded_width) * padded_height, 0);
+    unsigned char *pixels = &pending.pixels[ATLAS_PADDING * padded_width + ATLAS_PADDING];
+    if (sdf)
+        renderSdf(glyph_slot, pending.item, pixels, padded_width);
+    else
+        renderOutline(face.getFTLibrary(), glyph_slot, pending.item, pixels, padded_width);
+}
+
+void FontAtlas::prewarm(const std::vector<CodepointRange> &ranges, const std::vector<size_t> &pixelSizes,
+                        const std::shared_ptr<FontPrewarm::Progress> &progress)
+{
+    uint64_t id;
+    bool sdf;
+    std::vector<size_t> glyphSizes;
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        id = m_id;
+        sdf = isSdf();
+        for (size_t pixelSize : pixelSizes)
+            if (pixelSize > 0 && pixelSize <= maxPixelSize())
+                glyphSizes.push_back(glyphPixelSize(pixelSize));
+    }
+    std::sort(glyphSizes.begin(), glyphSizes.end());
+    glyphSizes.erase(std::unique(glyphSizes.begin(), glyphSizes.end()), glyphSizes.end());
+    size_t total = 0;
+    for (const CodepointRange &range : ranges)
+        if (range.first <= range.last)
+            total += (static_cast<size_t>(range.last) - range.first + 1) * glyphSizes.size();
+    progress->total.store(total, std::memory_order_relaxed);
+
+    // Batches are staged as they fill, syncTexture() publishes them. Staging waits
+    // while too much is staged, until a sync publishes some, or the prewarm is
+    // cancelled or waited for.
+    std::unique_ptr<FontFace> face = borrowFace();
+    PrewarmBatch batch;
+    auto stage = [&]()
+    {
+        if (batch.codepoints.empty())
+            return;
+        for (const PendingGlyph &glyph : batch.glyphs)
+            batch.bytes += glyph.pixels.size();
+        std::unique_lock<std::mutex> lock(m_prewarmMutex);
+        while (m_prewarmStagedBytes > PREWARM_STAGED_BYTES && progress->throttled.load(std::memory_order_relaxed) &&
+               !progress->cancelled.load(std::memory_order_relaxed))
+            m_prewarmPublished.wait_for(lock, std::chrono::milliseconds(50));
+        m_prewarmStagedBytes += batch.bytes;
+        m_prewarmBatches.push_back(std::move(batch));
+        batch = PrewarmBatch();
+    };
+    for (size_t glyphSize : glyphSizes)
+    {
+        for (const CodepointRange &range : ranges)
+        {
+            for (uint64_t codepoint = range.first; codepoint <= range.last; ++codepoint)
+            {
+                if (progress->cancelled.load(std::memory_order_relaxed))
+                    break;
+                bool skip = FT_Get_Char_Index(face->getFTFace(), codepoint) == 0;
+                if (!skip)
+                {
+                    std::shared_lock<std::shared_mutex> lock(m_mutex);
+                    const GlyphValue *item = m_glyphTable.find(codepoint, glyphSize);
+                    skip = item != nullptr && item->versionUV == m_currentVersion;
+                    if (m_id != id)
+                        progress->cancelled.store(true, std::memory_order_relaxed); // Mode changed
+                }
+                if (skip)
+                {
+                    progress->published.fetch_add(1, std::memory_order_relaxed);
+                    progress->rasterized.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                if (batch.codepoints.empty())
+                    batch = PrewarmBatch{id, glyphSize, {}, {}, progress};
+                batch.codepoints.push_back(static_cast<uint32_t>(codepoint));
+                batch.glyphs.emplace_back();
+                rasterizePending(*face, static_cast<uint32_t>(codepoint), glyphSize, sdf, batch.glyphs.back());
+                progress->rasterized.fetch_add(1, std::memory_order_relaxed);
+                if (batch.codepoints.size() == PREWARM_BATCH_GLYPHS)
+                    stage();
+            }
+        }
+        stage();
+    }
+    returnFace(std::move(face));
+}
+
+void FontAtlas::publishPrewarmed()
+{
+    std::vector<PrewarmBatch> batches;
+    {
+        std::lock_guard<std::mutex> lock(m_prewarmMutex);
+        batches.swap(m_prewarmBatches);
+    }
+    bool full = false;
+    size_t budget = PREWARM_PUBLISH_GLYPHS;
+    size_t done = 0;
+    size_t doneBytes = 0;
+    for (PrewarmBatch &batch : batches)
+    {
+        FontPrewarm::Progress &progress = *batch.progress;
+        const size_t first = batch.next;
+        if (batch.atlasId != m_id || full)
+            batch.next = batch.codepoints.size(); // Dropped for another mode or a full atlas
+        for (; batch.next < batch.codepoints.size() && budget > 0; ++batch.next, --budget)
+        {
+            const uint32_t codepoint = batch.codepoints[batch.next];
+            const GlyphValue *present = m_glyphTable.find(codepoint, batch.pixelSize);
+            if (present != nullptr && present->versionUV == m_currentVersion)
+                continue;
+            GlyphValue *item = m_glyphTable.find(codepoint, batch.pixelSize);
+            if (item == nullptr)
+                item = m_glyphTable.insert(codepoint, batch.pixelSize, batch.glyphs[batch.next].item);
+            if (!packGlyph(codepoint, batch.pixelSize, batch.glyphs[batch.next], *item))
+            {
+                // Full, glyphs drawn this frame stay rather than resetting for ahead of time ones
+                progress.cancelled.store(true, std::memory_order_relaxed);
+                full = true;
+                batch.next = batch.codepoints.size();
+                break;
+            }
+        }
+        progress.published.fetch_add(batch.next - first, std::memory_order_relaxed);
+        if (batch.next < batch.codepoints.size())
+            break; // Out of budget, the rest waits for the next sync
+        ++done;
+        doneBytes += batch.bytes;
+    }
+
+    // Unpublished batches go back in front of those staged meanwhile
+    std::lock_guard<std::mutex> lock(m_prewarmMutex);
+    m_prewarmBatches.insert(m_prewarmBatches.begin(), std::make_move_iterator(batches.begin() + done),
+                            std::make_move_iterator(batches.end()));
+    m_prewarmStagedBytes -= std::min(m_prewarmStagedBytes, doneBytes);
+    if (done > 0)
+        m_prewarmPublished.notify_all();
+}
+
+// Atlases with a prewarm running or glyphs staged
+static std::mutex s_prewarmsMutex;
+static std::vector<std::pair<std::weak_ptr<FontAtlas>, std::shared_ptr<FontPrewarm::Progress>>> s_prewarms;
+
+void FontAtlas::watchPrewarm(const std::shared_ptr<FontAtlas> &atlas,
+                             const std::shared_ptr<FontPrewarm::Progress> &progress)
+{
+    std::lock_guard<std::mutex> lock(s_prewarmsMutex);
+    s_prewarms.emplace_back(atlas, progress);
+}
+
+void FontAtlas::publishPrewarms()
+{
+    std::vector<std::shared_ptr<FontAtlas>> atlases;
+    {
+        std::lock_guard<std::mutex> lock(s_prewarmsMutex);
+        for (size_t i = 0; i < s_prewarms.size();)
+        {
+            std::shared_ptr<FontAtlas> atlas = s_prewarms[i].first.lock();
+            // Finished is read first, its batches were staged before it was set
+            const bool finished = s_prewarms[i].second->finished.load(std::memory_order_acquire);
+            bool staged = false;
+            if (atlas != nullptr)
+            {
+                std::lock_guard<std::mutex> prewarmLock(atlas->m_prewarmMutex);
+                staged = !atlas->m_prewarmBatches.empty();
+            }
+            if (atlas == nullptr || (finished && !staged))
+            {
+                s_prewarms.erase(s_prewarms.begin() + i);
+                continue;
+            }
+            if (std::find(atlases.begin(), atlases.end(), atlas) == atlases.end())
+                atlases.push_back(std::move(atlas));
+            ++i;
+        }
+    }
+    for (const std::shared_ptr<FontAtlas> &atlas : atlases)
+        atlas->syncTexture();
+}
+
+std::unique_ptr<FontFace> FontAtlas::borrowFace()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_spareFacesMutex);
+        if (!m_spareFaces.empty())
+        {
+            std::unique_ptr<FontFace> face = std::move(m_spareFaces.back());
+            m_spareFaces.pop_back();
+            return face;
+        }
+    }
+    // The font bytes are immutable, cloning needs no atlas lock
+    return m_fontFace->clone();
+}
+
+void FontAtlas::returnFace(std::unique_ptr<FontFace> face)
+{
+    std::lock_guard<std::mutex> lock(m_spareFacesMutex);
+    m_spareFaces.push_back(std::move(face));
+}
+
+bool FontAtlas::packGlyph(uint32_t codepoint, size_t pixelSize, const PendingGlyph &pending, GlyphValue &out_item)
+{
+    if (!pending.hasOutline)
+    {
+        out_item.versionUV = m_currentVersion;
+        return true;
+    }
+
+    int char_width = pending.item.width + 2 * glyphBorder();
+    int char_height = pending.item.height + 2 * glyphBorder();
+    int padded_width = char_width + 2 * ATLAS_PADDING;
+    int padded_height = char_height + 2 * ATLAS_PADDING;
+    int pos_x, pos_y;
+    if (!allocateRect(codepoint, pixelSize, padded_width, padded_height, pos_x, pos_y, out_item))
+    {
+        out_item.versionUV = 0;
+        return false;
+    }
+
+    int draw_x = pos_x + ATLAS_PADDING;
+    int draw_y = pos_y + ATLAS_PADDING;
+    std::memcpy(queueUpload(out_item.page, pos_x, pos_y, padded_width, padded_height),
+                pending.pixels.data(), pending.pixels.size());
 
     Bounds &textureUV = out_item.textureUV;
     textureUV.minx = static_cast<float>(draw_x) / getWidth();
@@ -148,8 +877,98 @@ bool FontAtlas::loadCharToAtlas(FT_GlyphSlot glyph_slot, GlyphValue &out_item)
     textureUV.maxx = textureUV.minx + static_cast<float>(char_width) / getWidth();
     textureUV.maxy = textureUV.miny + static_cast<float>(char_height) / getHeight();
 
-    m_isDirty = true;
-
     out_item.versionUV = m_currentVersion;
     return true;
 }
+
+bool FontAtlas::allocateRect(uint32_t codepoint, size_t pixelSize, int width, int height,
+                             int &pos_x, int &pos_y, GlyphValue &out_item)
+{
+    // Newest page first, older ones are mostly full
+    for (size_t page = m_pages.size(); page-- > 0;)
+        if (allocateOnPage(page, codepoint, pixelSize, width, height, pos_x, pos_y, out_item))
+            return true;
+    if (m_pages.size() < MAX_PAGES)
+    {
+        addPage();
+        return allocateOnPage(m_pages.size() - 1, codepoint, pixelSize, width, height, pos_x, pos_y, out_item);
+    }
+
+    if (!m_lruEviction)
+        return false;
+    while (evictShelf(height))
+        for (size_t page = m_pages.size(); page-- > 0;)
+            if (allocateOnPage(page, codepoint, pixelSize, width, height, pos_x, pos_y, out_item))
+                return true;
+    return false;
+}
+
+bool FontAtlas::allocateOnPage(size_t page, uint32_t codepoint, size_t pixelSize, int width, int height,
+                               int &pos_x, int &pos_y, GlyphValue &out_item)
+{
+    out_item.page = static_cast<int>(page);
+    if (!m_lruEviction)
+    {
+        out_item.shelf = -1;
+        return m_pages[page]->rectanizer.addRect(width, height, pos_x, pos_y);
+    }
+
+    const int local = m_pages[page]->shelves.addRect(width, height, pos_x, pos_y);
+    if (local < 0)
+        return false;
+    const size_t shelf = page * m_atlasSize + local;
+    if (shelf >= m_shelfGlyphs.size())
+        m_shelfGlyphs.resize(shelf + 1);
+    m_shelfGlyphs[shelf].push_back((static_cast<uint64_t>(pixelSize) << 32) | codepoint);
+    m_shelfUse[shelf].store(m_frame, std::memory_order_relaxed);
+    out_item.shelf = static_cast<int>(shelf);
+    return true;
+}
+
+bool FontAtlas::evictShelf(int height)
+{
+    // Least recently drawn shelf, preferring those tall enough for the new glyph
+    int victim = -1;
+    bool victimFits = false;
+    uint32_t victimUse = 0;
+    for (size_t page = 0; page < m_pages.size(); ++page)
+    {
+        const RectanizerShelf &shelves = m_pages[page]->shelves;
+        for (int i = 0; i < shelves.shelfCount(); ++i)
+        {
+            if (!shelves.isShelfUsed(i))
+                continue;
+            const int shelf = static_cast<int>(page * m_atlasSize) + i;
+            const uint32_t use = m_shelfUse[shelf].load(std::memory_order_relaxed);
+            if (use + EVICTION_SPARED_FRAMES > m_frame || m_shelfPins[shelf] != 0)
+                continue;
+            const bool fits = shelves.shelfHeight(i) >= height;
+            if (victim < 0 || (fits && !victimFits) || (fits == victimFits && use < victimUse))
+            {
+                victim = shelf;
+                victimFits = fits;
+                victimUse = use;
+            }
+        }
+    }
+    if (victim < 0)
+        return false;
+
+    for (uint64_t key : m_shelfGlyphs[victim])
+    {
+        GlyphValue *item = m_glyphTable.find(static_cast<uint32_t>(key), static_cast<size_t>(key >> 32));
+        if (item != nullptr && item->shelf == victim)
+        {
+            item->versionUV = 0;
+            item->shelf = -1;
+        }
+    }
+    m_shelfGlyphs[victim].clear();
+
+    // Stale texels of the shelf are left, new glyphs overwrite them with their padding
+    m_pages[victim / m_atlasSize]->shelves.clearShelf(static_cast<int>(victim % m_atlasSize));
+
+    ++m_shelfEpochs[victim];
+    ++m_evictions;
+    return true;
+}
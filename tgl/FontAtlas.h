@@ -2,55 +2,50 @@
 #define FONTATLAS_H
 
 #include "FontFace.h"
-#include "Bitmap.h"
+#include "GlyphTable.h"
 #include "Geometry.h"
 #include "RectanizerSkyline.h"
+#include "RectanizerShelf.h"
 #include "Texture.h"
-#include <unordered_map>
+#include "MappedFile.h"
+#include "FontPrewarm.h"
+#include <shared_mutex>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <vector>
 #include <cstring>
 
-struct GlyphKey
-{
-    uint32_t codepoint;
-    uint32_t pixelSize;
-    bool operator==(const GlyphKey &other) const
-    {
-        return codepoint == other.codepoint && pixelSize == other.pixelSize;
-    }
-};
-
-struct GlyphKeyHash
-{
-    size_t operator()(const GlyphKey &key) const
-    {
-        return std::hash<uint32_t>()(key.codepoint) ^ (std::hash<uint32_t>()(key.pixelSize) << 16);
-    }
-};
-
-struct GlyphValue
-{
-    /* Metric */
-    int width, height;
-    int bearingX, bearingY;
-    float advance;
-
-    FT_Pos bbox_xMin;
-    FT_Pos bbox_yMin;
-
-    /* Glyph */
-    size_t versionUV;
-    Bounds textureUV;
-};
-
 class FontAtlas
 {
+    /**
+     * Thread safety:
+     *
+     * Any thread may read the atlas ( findGlyph, findMetrics, getTexture ) while
+     * holding mutex() shared. Anything that rasterizes or resets ( glyph, metrics,
+     * reset ) needs mutex() exclusively, it uses the atlas' own face. Batches of
+     * prepareGlyphs() are rasterized without the lock on spare faces, so readers
+     * on other threads keep drawing meanwhile. No GL call is made outside
+     * syncTexture() and saveSnapshot(), which must run on the GL thread and lock
+     * by themselves. Atlas textures may lose their last reference on any thread
+     * ( a recorder cleared on a worker, FontRegistry::trim() dropping an atlas ),
+     * they are queued and deleted by releaseTextures() on the GL thread.
+     */
 public:
     static constexpr size_t ATLAS_SIZE = 1024;
     static constexpr size_t ATLAS_PADDING = 1;
+    // Pages are layers of one texture array, added as the atlas fills up
+    static constexpr size_t MAX_PAGES = 8;
+    // Signed distance field glyphs, stored once at SDF_PIXEL_SIZE for every size
+    static constexpr size_t SDF_PIXEL_SIZE = 48;
+    static constexpr int SDF_SPREAD = 8; // Default of FreeType's sdf renderer, 128 / SDF_SPREAD levels per texel
 
     FontAtlas(std::unique_ptr<FontFace> face, size_t atlasSize = ATLAS_SIZE);
     ~FontAtlas() = default;
     void reset();
+    // Frees all that is rebuilt on demand: glyphs, pages, worker faces and scratch
+    // storage. Locks by itself and resets, old textures go with the next syncTexture().
+    void trim();
 
     inline size_t maxPixelSize() const
     {
@@ -58,44 +53,231 @@ public:
     }
     GlyphValue *metrics(uint32_t codepoint, size_t pixelSize);
     GlyphValue *glyph(uint32_t codepoint, size_t pixelSize);
+    // Rasterizes the glyphs of codepoints missing from the atlas, in parallel on
+    // the shared ThreadPool when there are enough of them, then packs them in one
+    // step. Stops when the atlas is full, glyph() resets it as usual. Locks by
+    // itself, exclusively only to pack.
+    void prepareGlyphs(const uint32_t *codepoints, size_t count, size_t pixelSize);
+    // Rasterizes every codepoint of ranges at every pixel size on the calling thread,
+    // without the lock, skipping glyphs present or missing from the font. They are
+    // staged in batches and packed by syncTexture(), when they become visible, waiting
+    // while PREWARM_STAGED_BYTES are staged. Stops when progress is cancelled or the
+    // atlas mode changes, see FontPrewarm.
+    void prewarm(const std::vector<CodepointRange> &ranges, const std::vector<size_t> &pixelSizes,
+                 const std::shared_ptr<FontPrewarm::Progress> &progress);
 
-    // Texture
-    inline std::shared_ptr<Texture> getTexture()
+    // Lookups without rasterizing, nullptr on miss
+    inline const GlyphValue *findMetrics(uint32_t codepoint, size_t pixelSize) const
     {
-        return m_texture;
+        return m_glyphTable.find(codepoint, pixelSize);
     }
-    inline void syncTexture()
+    inline const GlyphValue *findGlyph(uint32_t codepoint, size_t pixelSize) const
     {
-        if (m_isDirty)
-        {
-            m_texture->update(0, 0, getWidth(), getHeight(), bufferPointer());
-            m_isDirty = false;
-        }
+        const GlyphValue *item = m_glyphTable.find(codepoint, pixelSize);
+        if (item == nullptr || item->versionUV != m_currentVersion)
+            return nullptr;
+        touchShelf(item->shelf);
+        return item;
     }
 
-    // Getters
-    inline size_t getHeight() const { return m_atlasBuffer.getHeight(); }
-    inline size_t getWidth() const { return m_atlasBuffer.getWidth(); }
+    // When all pages are full, reset() drops every glyph at once ( default ). With
+    // LRU eviction glyphs are packed on shelves instead and the least recently
+    // drawn shelf is freed in place, sparing shelves drawn since the one before
+    // last syncTexture(). Recorders touch the shelves they drew from on every
+    // commit, pictures pin theirs. Locks by itself and resets.
+    void setLruEviction(bool enabled);
+    // Marks a shelf as drawn in this frame, for users of cached glyphs
+    inline void touchShelf(int shelf) const
+    {
+        if (shelf >= 0)
+            m_shelfUse[shelf].store(m_frame, std::memory_order_relaxed);
+    }
+    // Keeps shelves from eviction while retained content samples them. Pins end with
+    // unpinShelves() given the returned epoch, or with any reset(), after which the
+    // content keeps the replaced texture. Lock by themselves, no-ops without LRU.
+    uint64_t pinShelves(const std::vector<int> &shelves);
+    void unpinShelves(const std::vector<int> &shelves, uint64_t epoch);
+    // Bumped each time the shelf is evicted, so caches of glyph UVs outlive evictions
+    // of other shelves. evictions() counts them over the atlas. Read under mutex().
+    inline uint32_t shelfEpoch(int shelf) const { return m_shelfEpochs[shelf]; }
+    inline uint64_t evictions() const { return m_evictions; }
+
+    // SDF mode: glyphs are rasterized unhinted as distance fields at SDF_PIXEL_SIZE
+    // and drawn scaled to any pixel size ( DRAW_FONT_SDF ), so zooming or animated
+    // sizes add no glyphs. Locks by itself, resets and drops all metrics, the atlas
+    // gets a new id() then.
+    void setSdf(bool enabled);
+    inline bool isSdf() const { return m_sdf.load(std::memory_order_relaxed); }
+    // Pixel size the glyphs drawn at pixelSize are stored at
+    inline size_t glyphPixelSize(size_t pixelSize) const { return isSdf() ? SDF_PIXEL_SIZE : pixelSize; }
+    // Texels around each glyph's metrics box in its textureUV, at the stored size
+    inline int glyphBorder() const { return isSdf() ? SDF_SPREAD : 0; }
+
+    // Area any glyph at pixelSize may cover relative to its pen position ( y down ),
+    // infinite for faces without a scalable bbox. Lock free, the face's bbox is fixed.
+    Bounds extents(size_t pixelSize) const;
 
-    // Buffer
-    inline size_t rowBytes() { return m_atlasBuffer.rowBytes(); }
-    inline size_t bufferSize() { return m_atlasBuffer.bufferSize(); }
-    inline unsigned char *bufferPointer() { return m_atlasBuffer.bufferPointer(); }
+    inline std::shared_mutex &mutex() const { return m_mutex; }
+
+    // Unique per atlas and mode, for caches keyed by atlas that may outlive it, read under mutex()
+    inline uint64_t id() const { return m_id; }
+    // Bumped whenever texture UVs of all cached glyphs become invalid ( reset ),
+    // evictions bump shelfEpoch() instead. Read under mutex().
+    inline uint64_t generation() const { return m_generation; }
+
+    // Texture ( GL_TEXTURE_2D_ARRAY, GlyphValue::page is the layer )
+    inline const std::shared_ptr<Texture> &getTexture() const
+    {
+        return m_texture;
+    }
+    // Packs up to PREWARM_PUBLISH_GLYPHS prewarmed glyphs and uploads everything new,
+    // GL thread only
+    void syncTexture();
+    // Syncs every atlas with a prewarm running or glyphs staged, so atlases nothing
+    // drew from yet fill too. GL thread only, called once per frame by
+    // GraphicsRenderer::render(), call it yourself without one.
+    static void publishPrewarms();
+    // Deletes the textures released since the last call, GL thread only. Called
+    // once per frame by GraphicsRenderer::render(), call it yourself without one.
+    static void releaseTextures();
+
+    // Snapshots hold the glyphs, page layouts and pixels of the atlas in a versioned
+    // binary file, valid for the same font bytes, atlas size and mode only.
+    // saveSnapshot() reads the texture back, GL thread only. loadSnapshot() maps the
+    // file and replaces the atlas without FreeType, the pages are uploaded straight
+    // from the mapping by the next syncTexture(). Both lock by themselves and return
+    // false on failure, or for a missing, stale or foreign file when loading.
+    bool saveSnapshot(const char *path);
+    bool loadSnapshot(const char *path);
+
+    // Getters ( of a page )
+    inline size_t getHeight() const { return m_atlasSize; }
+    inline size_t getWidth() const { return m_atlasSize; }
+    inline size_t pageCount() const { return m_pages.size(); }
 
 private:
     std::unique_ptr<FontFace> m_fontFace;
     size_t m_atlasSize;
-    Bitmap m_atlasBuffer;
-    std::unordered_map<GlyphKey, GlyphValue, GlyphKeyHash> m_atlasMap;
-    RectanizerSkyline m_rectanizer;
+    GlyphTable m_glyphTable;
     std::shared_ptr<Texture> m_texture;
-    bool m_isDirty = false;
+    mutable std::shared_mutex m_mutex;
+    uint64_t m_id;
+    uint64_t m_generation = 0;
+    std::atomic<bool> m_sdf{false}; // Read without lock for culling
+
+    // Pages, packed by the skyline or by shelves with LRU eviction. Their pixels
+    // only live in the texture.
+    struct Page
+    {
+        RectanizerSkyline rectanizer;
+        RectanizerShelf shelves;
+        Page(int size) : rectanizer(size, size), shelves(size, size) {}
+    };
+    std::vector<std::unique_ptr<Page>> m_pages;
+    void addPage();
+
+    // Glyphs rasterized since the last syncTexture(), each uploaded on its own
+    // with its zeroed padding, so nothing else of the texture needs to be known
+    static constexpr size_t UPLOAD_SCRATCH_BYTES = 64 * 1024; // Kept between syncs
+    struct GlyphUpload
+    {
+        int page;
+        int x, y, width, height;
+        size_t offset; // In Uploads::pixels, width * height bytes
+    };
+    struct Uploads
+    {
+        std::vector<GlyphUpload> rects;
+        std::vector<unsigned char> pixels;
+        // Whole pages of a loaded snapshot, uploaded before the rects
+        std::unique_ptr<MappedFile> snapshot;
+        size_t snapshotOffset = 0;
+        size_t snapshotPages = 0;
+        inline bool empty() const { return rects.empty() && snapshot == nullptr; }
+    };
+    Uploads m_uploads;
+    unsigned char *queueUpload(int page, int x, int y, int width, int height);
+    // Deferred texture whose deletion is queued for releaseTextures()
+    std::shared_ptr<Texture> createTexture() const;
+    static void uploadGlyphs(Texture &texture, size_t pages, const Uploads &uploads);
+    void uploadPending();
+
+    // Textures replaced by reset() that still wait for their upload
+    struct RetiredTexture
+    {
+        std::shared_ptr<Texture> texture;
+        size_t pages;
+        Uploads uploads;
+    };
+    std::vector<RetiredTexture> m_retiredTextures;
     size_t m_currentVersion = 1;
-    size_t m_pixelSize = 0;
+
+    // LRU eviction, last use per shelf as the frame counted by syncTexture().
+    // Shelf ids are page * m_atlasSize + shelf id in the page.
+    static constexpr uint32_t EVICTION_SPARED_FRAMES = 2;
+    bool m_lruEviction = false;
+    std::unique_ptr<std::atomic<uint32_t>[]> m_shelfUse;
+    std::unique_ptr<uint32_t[]> m_shelfPins; // Pin count per shelf, under the lock
+    std::unique_ptr<uint32_t[]> m_shelfEpochs; // Evictions per shelf, under the lock
+    uint64_t m_evictions = 0;
+    uint64_t m_pinEpoch = 0;                 // Bumped by reset(), dropping all pins
+    std::vector<std::vector<uint64_t>> m_shelfGlyphs; // Codepoint | pixelSize << 32
+    uint32_t m_frame = EVICTION_SPARED_FRAMES;
+    bool allocateRect(uint32_t codepoint, size_t pixelSize, int width, int height,
+                      int &pos_x, int &pos_y, GlyphValue &out_item);
+    bool allocateOnPage(size_t page, uint32_t codepoint, size_t pixelSize, int width, int height,
+                        int &pos_x, int &pos_y, GlyphValue &out_item);
+    bool evictShelf(int height);
+
+    // Batch rasterization outside the atlas lock, one borrowed face per pool
+    // thread and a bitmap per glyph
+    static constexpr size_t PARALLEL_MIN_GLYPHS = 16;
+    struct PendingGlyph
+    {
+        GlyphValue item;
+        bool hasOutline;
+        std::vector<unsigned char> pixels; // Padded by ATLAS_PADDING
+    };
+    std::mutex m_spareFacesMutex;
+    std::vector<std::unique_ptr<FontFace>> m_spareFaces; // Clones of m_fontFace
+    std::unique_ptr<FontFace> borrowFace();
+    void returnFace(std::unique_ptr<FontFace> face);
+    static void rasterizePending(FontFace &face, uint32_t codepoint, size_t pixelSize, bool sdf, PendingGlyph &pending);
+
+    // Glyphs rasterized by prewarm(), packed by syncTexture() until the atlas is full.
+    // A sync packs a bounded number, so one frame never evicts or grows the atlas by
+    // much, and rasterizing waits while too many bytes are staged.
+    static constexpr size_t PREWARM_BATCH_GLYPHS = 64;
+    static constexpr size_t PREWARM_PUBLISH_GLYPHS = 256;
+    static constexpr size_t PREWARM_STAGED_BYTES = 16 * 1024 * 1024;
+    struct PrewarmBatch
+    {
+        uint64_t atlasId;
+        size_t pixelSize;
+        std::vector<uint32_t> codepoints;
+        std::vector<PendingGlyph> glyphs;
+        std::shared_ptr<FontPrewarm::Progress> progress;
+        size_t next = 0;  // First glyph not published yet
+        size_t bytes = 0; // Of the glyphs' pixels
+    };
+    std::mutex m_prewarmMutex;
+    std::condition_variable m_prewarmPublished;
+    std::vector<PrewarmBatch> m_prewarmBatches;
+    size_t m_prewarmStagedBytes = 0;
+    void publishPrewarmed();
+    // Registers a prewarm of atlas for publishPrewarms(), by FontPrewarm
+    static void watchPrewarm(const std::shared_ptr<FontAtlas> &atlas,
+                             const std::shared_ptr<FontPrewarm::Progress> &progress);
+    friend class FontPrewarm;
 
     FT_GlyphSlot loadCharFTGlyphSlot(uint32_t codepoint, size_t pixelSize);
-    void loadCharMetrics(FT_GlyphSlot glyph_slot, GlyphValue &out_item);
-    bool loadCharToAtlas(FT_GlyphSlot glyph_slot, GlyphValue &out_item);
+    static inline FT_Int32 loadFlags(bool sdf) { return sdf ? FT_LOAD_NO_HINTING : FT_LOAD_DEFAULT; }
+    static void loadCharMetrics(FT_GlyphSlot glyph_slot, bool sdf, GlyphValue &out_item);
+    bool loadCharToAtlas(uint32_t codepoint, size_t pixelSize, FT_GlyphSlot glyph_slot, GlyphValue &out_item);
+    static void renderOutline(FT_Library library, FT_GlyphSlot glyph_slot, const GlyphValue &item,
+                              unsigned char *buffer, int pitch);
+    static void renderSdf(FT_GlyphSlot glyph_slot, const GlyphValue &item, unsigned char *buffer, int pitch);
+    bool packGlyph(uint32_t codepoint, size_t pixelSize, const PendingGlyph &pending, GlyphValue &out_item);
 };
 
 #endif
@@ -0,0 +1,80 @@
+#include "FontData.h"
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+std::shared_ptr<const FontData> FontData::fromFile(const char *path)
+{
+    static std::mutex mutex;
+    static std::unordered_map<std::string, std::weak_ptr<const FontData>> files;
+
+    // Different spellings of the same path share one mapping
+    std::error_code error;
+    std::string key = std::filesystem::weakly_canonical(path, error).string();
+    if (error)
+        key = path;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (std::shared_ptr<const FontData> data = files[key].lock())
+        return data;
+
+    std::unique_ptr<MappedFile> file = std::make_unique<MappedFile>(path);
+    if (!file->isValid())
+        throw std::runtime_error(std::string("Font error: failed to open ") + path);
+    std::shared_ptr<const FontData> data(new FontData(std::move(file)));
+    files[key] = data;
+
+    // Drop the entries of files no longer used
+    for (auto it = files.begin(); it != files.end();)
+        it = it->second.expired() ? files.erase(it) : std::next(it);
+    return data;
+}
+
+std::shared_ptr<const FontData> FontData::fromStream(std::istream &stream)
+{
+    static std::mutex mutex;
+    static std::unordered_multimap<uint64_t, std::weak_ptr<const FontData>> contents;
+
+    std::vector<unsigned char> bytes(std::istreambuf_iterator<char>(stream), {});
+    if (stream.bad() || bytes.empty())
+        throw std::runtime_error("Font error: failed to read font stream");
+    std::shared_ptr<const FontData> read = std::make_shared<const FontData>(std::move(bytes));
+    const uint64_t hash = read->contentHash();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto range = contents.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        std::shared_ptr<const FontData> data = it->second.lock();
+        if (data != nullptr && data->size() == read->size() && std::memcmp(data->data(), read->data(), read->size()) == 0)
+            return data;
+    }
+    for (auto it = contents.begin(); it != contents.end();)
+        it = it->second.expired() ? contents.erase(it) : std::next(it);
+    contents.emplace(hash, read);
+    return read;
+}
+
+FontData::FontData(std::unique_ptr<MappedFile> file)
+    : m_file(std::move(file)), m_bytes(m_file->data()), m_size(m_file->size())
+{
+}
+
+FontData::FontData(std::vector<unsigned char> bytes)
+    : m_buffer(std::move(bytes)), m_bytes(m_buffer.data()), m_size(m_buffer.size())
+{
+}
+
+uint64_t FontData::contentHash() const
+{
+    std::call_once(m_hashOnce, [this]()
+                   {
+                       uint64_t hash = 0xCBF29CE484222325ull;
+                       for (size_t i = 0; i < m_size; ++i)
+                           hash = (hash ^ m_bytes[i]) * 0x100000001B3ull;
+                       m_contentHash = hash; });
+    return m_contentHash;
+}
@@ -0,0 +1,51 @@
+#ifndef FONTDATA_H
+#define FONTDATA_H
+
+#include "MappedFile.h"
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//
+// FontData
+//
+// Read-only font bytes handed to FreeType as a memory face. Files are mapped
+// once per path, streams are read once per content, and the bytes are shared
+// by every face and atlas using them until the last reference goes away.
+class FontData
+{
+public:
+    // Shared data of the file at path, throws when it cannot be read
+    static std::shared_ptr<const FontData> fromFile(const char *path);
+    // Shared data of the whole stream, throws when it cannot be read
+    static std::shared_ptr<const FontData> fromStream(std::istream &stream);
+    FontData(std::vector<unsigned char> bytes);
+    ~FontData() = default;
+
+    // Getters
+    inline const unsigned char *data() const { return m_bytes; }
+    inline size_t size() const { return m_size; }
+    // 64-bit FNV-1a of the bytes, computed on first use
+    uint64_t contentHash() const;
+
+    // Copying and move semantics
+    FontData(const FontData &other) = delete;
+    FontData &operator=(const FontData &other) = delete;
+    FontData(FontData &&other) = delete;
+    FontData &operator=(FontData &&other) = delete;
+
+private:
+    FontData(std::unique_ptr<MappedFile> file);
+
+    std::unique_ptr<MappedFile> m_file;
+    std::vector<unsigned char> m_buffer;
+    const unsigned char *m_bytes = nullptr;
+    size_t m_size = 0;
+
+    mutable std::once_flag m_hashOnce;
+    mutable uint64_t m_contentHash = 0;
+};
+
+#endif
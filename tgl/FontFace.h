@@ -1,8 +1,10 @@
 #ifndef FONTFACE_H
 #define FONTFACE_H
 
+#include "FontData.h"
 #include <istream>
 #include <memory>
+#include <mutex>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -10,6 +12,8 @@
 //
 // FontManager
 //
+// One FT_Library for the process. FreeType lets threads share it as long as faces
+// are created and destroyed one at a time, which m_mutex serializes.
 class FontManager
 {
 public:
@@ -28,6 +32,7 @@ private:
     };
 
     FT_Library m_ftLib = nullptr;
+    std::mutex m_mutex;
 
     friend class FontFace;
 };
@@ -35,21 +40,37 @@ private:
 //
 // FontFace
 //
+// One FT_Face, used by one thread at a time: setting the size and loading a glyph
+// change the face and its glyph slot. Threads working on the same font each use
+// a clone(), clones only share the read-only font bytes.
 class FontFace
 {
 public:
+    // Maps the file, shared with every other face of the same path
     FontFace(const char *path);
+    // Reads the whole stream, shared with every other face of the same bytes
     FontFace(std::unique_ptr<std::istream> file);
+    FontFace(std::shared_ptr<const FontData> data);
     ~FontFace();
 
+    // Another face of the same font bytes for use on another thread
+    std::unique_ptr<FontFace> clone() const;
+    inline uint64_t contentHash() const
+    {
+        return m_data->contentHash();
+    }
+
     inline void setPixelSize(size_t pixelSize)
     {
+        if (pixelSize == m_pixelSize)
+            return;
         if (FT_Set_Pixel_Sizes(m_ftFace, 0, pixelSize))
             throw std::runtime_error("Freetype error: FT_Set_Pixel_Sizes");
+        m_pixelSize = pixelSize;
     }
-    inline void loadChar(uint64_t codepoint)
+    inline void loadChar(uint64_t codepoint, FT_Int32 loadFlags = FT_LOAD_DEFAULT)
     {
-        if (FT_Load_Char(m_ftFace, codepoint, FT_LOAD_DEFAULT | FT_LOAD_NO_BITMAP))
+        if (FT_Load_Char(m_ftFace, codepoint, loadFlags | FT_LOAD_NO_BITMAP))
             throw std::runtime_error("Freetype error: FT_Load_Char");
     }
 
@@ -75,10 +96,12 @@ public:
 
 private:
     class FontManager &m_fontManager;
-    std::unique_ptr<std::istream> m_istreamPointer;
-
-    FT_StreamRec m_ftStreamRec;
+    // FreeType reads the bytes in place, they must outlive m_ftFace
+    std::shared_ptr<const FontData> m_data;
     FT_Face m_ftFace = nullptr;
+    size_t m_pixelSize = 0;
+
+    void openFace();
 };
 
 #endif
@@ -0,0 +1,54 @@
+#include "FontPrewarm.h"
+#include "FontAtlas.h"
+#include <exception>
+
+FontPrewarm::FontPrewarm(std::shared_ptr<FontAtlas> atlas, std::vector<CodepointRange> ranges, std::vector<size_t> pixelSizes)
+    : m_atlas(std::move(atlas)), m_progress(std::make_shared<Progress>())
+{
+    FontAtlas::watchPrewarm(m_atlas, m_progress);
+    m_thread = std::thread([atlas = m_atlas, progress = m_progress,
+                            ranges = std::move(ranges), pixelSizes = std::move(pixelSizes)]()
+                           {
+                               try
+                               {
+                                   atlas->prewarm(ranges, pixelSizes, progress);
+                               }
+                               catch (const std::exception &)
+                               {
+                                   // A FreeType error or running out of memory ends the prewarm like a cancel
+                                   progress->cancelled.store(true, std::memory_order_relaxed);
+                               }
+                               progress->finished.store(true, std::memory_order_release); });
+}
+
+FontPrewarm::~FontPrewarm()
+{
+    cancel();
+    wait();
+}
+
+float FontPrewarm::progress() const
+{
+    const size_t total = m_progress->total.load(std::memory_order_relaxed);
+    if (total == 0)
+        return isDone() ? 1.0f : 0.0f;
+    return static_cast<float>(m_progress->published.load(std::memory_order_relaxed)) / total;
+}
+
+bool FontPrewarm::isDone() const
+{
+    return m_progress->finished.load(std::memory_order_acquire) &&
+           m_progress->published.load(std::memory_order_relaxed) == m_progress->rasterized.load(std::memory_order_relaxed);
+}
+
+void FontPrewarm::cancel()
+{
+    m_progress->cancelled.store(true, std::memory_order_relaxed);
+}
+
+void FontPrewarm::wait()
+{
+    m_progress->throttled.store(false, std::memory_order_relaxed);
+    if (m_thread.joinable())
+        m_thread.join();
+}
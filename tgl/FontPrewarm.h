@@ -0,0 +1,67 @@
+#ifndef FONTPREWARM_H
+#define FONTPREWARM_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class FontAtlas;
+
+// Codepoints first to last, inclusive
+struct CodepointRange
+{
+    uint32_t first;
+    uint32_t last;
+};
+
+//
+// FontPrewarm
+//
+// Rasterizes glyphs ahead of time on a thread of its own, see Font::prewarm().
+// GraphicsRenderer::render() packs and uploads a bounded number of the glyphs
+// rasterized so far each frame ( FontAtlas::publishPrewarms ), so they become
+// visible between two frames, whether or not anything drew with the font yet.
+// Destroying the prewarm cancels it, glyphs already rasterized are still published.
+class FontPrewarm
+{
+public:
+    // Shared with the thread and the atlas, counts of ( codepoint, pixel size ) pairs.
+    // Pairs the font has no glyph for, or already in the atlas, count as published.
+    struct Progress
+    {
+        std::atomic<size_t> total{0};
+        std::atomic<size_t> rasterized{0};
+        std::atomic<size_t> published{0};
+        std::atomic<bool> cancelled{false}; // By cancel(), or when the atlas is full
+        std::atomic<bool> finished{false};  // Nothing left to rasterize
+        std::atomic<bool> throttled{true};  // Staging waits for publishing, until wait()
+    };
+
+    FontPrewarm(std::shared_ptr<FontAtlas> atlas, std::vector<CodepointRange> ranges, std::vector<size_t> pixelSizes);
+    ~FontPrewarm();
+
+    // Published fraction of all pairs, in [0, 1]
+    float progress() const;
+    // Every rasterized glyph published and nothing left to rasterize
+    bool isDone() const;
+    inline bool isCancelled() const { return m_progress->cancelled.load(std::memory_order_relaxed); }
+    void cancel();
+    // Blocks until rasterizing is over, lifting the limit on staged glyphs so it does
+    // not wait for frames. The glyphs are still published by the next frames.
+    void wait();
+
+    // Copying and move semantics
+    FontPrewarm(const FontPrewarm &other) = delete;
+    FontPrewarm &operator=(const FontPrewarm &other) = delete;
+    FontPrewarm(FontPrewarm &&other) = delete;
+    FontPrewarm &operator=(FontPrewarm &&other) = delete;
+
+private:
+    std::shared_ptr<FontAtlas> m_atlas;
+    std::shared_ptr<Progress> m_progress;
+    std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "FontRegistry.h"
+#include "FontAtlas.h"
+#include <vector>
+
+FontRegistry &FontRegistry::getInstance()
+{
+    static FontRegistry instance;
+    return instance;
+}
+
+std::shared_ptr<FontAtlas> FontRegistry::atlas(const std::shared_ptr<const FontData> &data, uint32_t options)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::weak_ptr<FontAtlas> &entry = m_atlases[Key(data.get(), options)];
+    if (std::shared_ptr<FontAtlas> atlas = entry.lock())
+        return atlas;
+
+    std::shared_ptr<FontAtlas> atlas = std::make_shared<FontAtlas>(std::make_unique<FontFace>(data));
+    if (options & OPTION_LRU_EVICTION)
+        atlas->setLruEviction(true);
+    if (options & OPTION_SDF)
+        atlas->setSdf(true);
+    entry = atlas;
+    removeExpired();
+    return atlas;
+}
+
+void FontRegistry::trim()
+{
+    std::vector<std::shared_ptr<FontAtlas>> live;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        removeExpired();
+        for (const auto &entry : m_atlases)
+            if (std::shared_ptr<FontAtlas> atlas = entry.second.lock())
+                live.push_back(std::move(atlas));
+    }
+    // Without the registry lock, an atlas may be busy rasterizing
+    for (const std::shared_ptr<FontAtlas> &atlas : live)
+        atlas->trim();
+}
+
+size_t FontRegistry::size()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    removeExpired();
+    return m_atlases.size();
+}
+
+void FontRegistry::removeExpired()
+{
+    for (auto it = m_atlases.begin(); it != m_atlases.end();)
+        it = it->second.expired() ? m_atlases.erase(it) : std::next(it);
+}
@@ -0,0 +1,49 @@
+#ifndef FONTREGISTRY_H
+#define FONTREGISTRY_H
+
+#include "FontData.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+class FontAtlas;
+
+//
+// FontRegistry
+//
+// Process-wide atlases by font bytes and mode, so every Font of the same file or
+// content shares one atlas and texture. Entries are weak, an atlas lives as long
+// as a Font or recorder holds it.
+class FontRegistry
+{
+public:
+    // Modes an atlas is created with, fonts with different modes get different atlases
+    static constexpr uint32_t OPTION_LRU_EVICTION = 1u << 0;
+    static constexpr uint32_t OPTION_SDF = 1u << 1;
+
+    static FontRegistry &getInstance();
+
+    std::shared_ptr<FontAtlas> atlas(const std::shared_ptr<const FontData> &data, uint32_t options = 0);
+
+    // Under memory pressure: drops the glyphs, pages and scratch storage of every
+    // live atlas ( FontAtlas::trim ) and forgets the released ones. Atlases refill
+    // as text is drawn. Any thread: textures of the old pages and dropped atlases
+    // are deleted on the GL thread by FontAtlas::releaseTextures().
+    void trim();
+    // Atlases still alive
+    size_t size();
+
+private:
+    FontRegistry() = default;
+    ~FontRegistry() = default;
+
+    // The data is kept alive by its atlas, so its address stays unique while the entry is used
+    using Key = std::pair<const FontData *, uint32_t>;
+    std::map<Key, std::weak_ptr<FontAtlas>> m_atlases;
+    std::mutex m_mutex;
+
+    void removeExpired();
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "GlyphTable.h"
+#include <algorithm>
+
+constexpr size_t SPARSE_MIN_CAPACITY = 64;
+
+GlyphTable::GlyphTable(uint32_t denseRange)
+    : m_denseRange(denseRange)
+{
+}
+
+GlyphValue *GlyphTable::insert(uint32_t codepoint, size_t pixelSize, const GlyphValue &value)
+{
+    m_size += 1;
+    if (codepoint < m_denseRange)
+    {
+        if (pixelSize >= m_densePageOf.size())
+            m_densePageOf.resize(pixelSize + 1, 0);
+        if (m_densePageOf[pixelSize] == 0)
+        {
+            DensePage &page = m_densePages.emplace_back();
+            page.values.resize(m_denseRange);
+            page.present.assign(m_denseRange, 0);
+            m_densePageOf[pixelSize] = static_cast<uint32_t>(m_densePages.size());
+        }
+        DensePage &page = m_densePages[m_densePageOf[pixelSize] - 1];
+        page.present[codepoint] = 1;
+        page.values[codepoint] = value;
+        return &page.values[codepoint];
+    }
+
+    // Keep the load factor at most 1/2
+    if ((m_sparseSize + 1) * 2 > m_keys.size())
+        rehash(std::max(SPARSE_MIN_CAPACITY, m_keys.size() * 2));
+    m_sparseSize += 1;
+
+    const uint64_t key = packKey(codepoint, pixelSize);
+    const size_t mask = m_keys.size() - 1;
+    size_t slot = hashKey(key) & mask;
+    while (m_keys[slot] != EMPTY_KEY)
+        slot = (slot + 1) & mask;
+    m_keys[slot] = key;
+    m_values[slot] = value;
+    return &m_values[slot];
+}
+
+void GlyphTable::clear()
+{
+    // Keep storage for the glyphs that come back, unless it was mostly unused
+    if (m_sparseSize < m_keys.size() / 8)
+    {
+        decltype(m_keys){}.swap(m_keys);
+        decltype(m_values){}.swap(m_values);
+    }
+    else
+    {
+        std::fill(m_keys.begin(), m_keys.end(), EMPTY_KEY);
+    }
+    for (DensePage &page : m_densePages)
+        std::fill(page.present.begin(), page.present.end(), 0);
+    m_size = 0;
+    m_sparseSize = 0;
+}
+
+void GlyphTable::rehash(size_t capacity)
+{
+    std::vector<uint64_t> keys(capacity, EMPTY_KEY);
+    std::vector<GlyphValue> values(capacity);
+    const size_t mask = capacity - 1;
+    for (size_t i = 0; i < m_keys.size(); ++i)
+    {
+        if (m_keys[i] == EMPTY_KEY)
+            continue;
+        size_t slot = hashKey(m_keys[i]) & mask;
+        while (keys[slot] != EMPTY_KEY)
+            slot = (slot + 1) & mask;
+        keys[slot] = m_keys[i];
+        values[slot] = m_values[i];
+    }
+    m_keys.swap(keys);
+    m_values.swap(values);
+}
@@ -0,0 +1,126 @@
+#ifndef GLYPHTABLE_H
+#define GLYPHTABLE_H
+
+#include "Geometry.h"
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct GlyphValue
+{
+    /* Metric */
+    int width, height;
+    int bearingX, bearingY;
+    float advance;
+
+    FT_Pos bbox_xMin;
+    FT_Pos bbox_yMin;
+
+    /* Glyph */
+    size_t versionUV;
+    Bounds textureUV;
+    int page;  // Layer of the atlas texture
+    int shelf; // Eviction unit of the atlas holding the glyph, -1 if none
+};
+
+//
+// GlyphTable
+//
+// Glyphs by codepoint and pixel size. Codepoints below the dense range are
+// stored in a plain array per pixel size, the rest in a flat open addressing
+// table probed linearly over packed keys. Pointers returned stay valid until
+// the next insert() or clear().
+class GlyphTable
+{
+public:
+    static constexpr uint32_t DEFAULT_DENSE_RANGE = 256;
+
+    GlyphTable(uint32_t denseRange = DEFAULT_DENSE_RANGE);
+    ~GlyphTable() = default;
+
+    inline const GlyphValue *find(uint32_t codepoint, size_t pixelSize) const
+    {
+        if (codepoint < m_denseRange)
+        {
+            if (pixelSize >= m_densePageOf.size() || m_densePageOf[pixelSize] == 0)
+                return nullptr;
+            const DensePage &page = m_densePages[m_densePageOf[pixelSize] - 1];
+            return page.present[codepoint] ? &page.values[codepoint] : nullptr;
+        }
+        if (m_keys.empty())
+            return nullptr;
+        const uint64_t key = packKey(codepoint, pixelSize);
+        const size_t mask = m_keys.size() - 1;
+        for (size_t slot = hashKey(key) & mask;; slot = (slot + 1) & mask)
+        {
+            if (m_keys[slot] == key)
+                return &m_values[slot];
+            if (m_keys[slot] == EMPTY_KEY)
+                return nullptr;
+        }
+    }
+    inline GlyphValue *find(uint32_t codepoint, size_t pixelSize)
+    {
+        return const_cast<GlyphValue *>(static_cast<const GlyphTable *>(this)->find(codepoint, pixelSize));
+    }
+
+    // Calls fn(codepoint, pixelSize, value) for every glyph, in no particular order
+    template <typename Fn>
+    inline void forEach(Fn &&fn) const
+    {
+        for (size_t pixelSize = 0; pixelSize < m_densePageOf.size(); ++pixelSize)
+        {
+            if (m_densePageOf[pixelSize] == 0)
+                continue;
+            const DensePage &page = m_densePages[m_densePageOf[pixelSize] - 1];
+            for (uint32_t codepoint = 0; codepoint < m_denseRange; ++codepoint)
+                if (page.present[codepoint])
+                    fn(codepoint, pixelSize, page.values[codepoint]);
+        }
+        for (size_t slot = 0; slot < m_keys.size(); ++slot)
+            if (m_keys[slot] != EMPTY_KEY)
+                fn(static_cast<uint32_t>(m_keys[slot]), static_cast<size_t>(m_keys[slot] >> 32), m_values[slot]);
+    }
+
+    // The glyph must not be in the table yet
+    GlyphValue *insert(uint32_t codepoint, size_t pixelSize, const GlyphValue &value);
+    void clear();
+
+    inline size_t size() const { return m_size; }
+
+private:
+    static constexpr uint64_t EMPTY_KEY = ~0ull;
+
+    uint32_t m_denseRange;
+    size_t m_size = 0;
+
+    // Dense pages, m_densePageOf[pixelSize] is the page index + 1 or 0
+    struct DensePage
+    {
+        std::vector<GlyphValue> values;
+        std::vector<uint8_t> present;
+    };
+    std::vector<DensePage> m_densePages;
+    std::vector<uint32_t> m_densePageOf;
+
+    // Sparse table, keys apart from values so probing stays in few cache lines
+    std::vector<uint64_t> m_keys;
+    std::vector<GlyphValue> m_values;
+    size_t m_sparseSize = 0;
+
+    static inline uint64_t packKey(uint32_t codepoint, size_t pixelSize)
+    {
+        return (static_cast<uint64_t>(pixelSize) << 32) | codepoint;
+    }
+    static inline size_t hashKey(uint64_t key)
+    {
+        // Fibonacci hashing, high bits folded down for the power of two mask
+        key *= 0x9E3779B97F4A7C15ull;
+        return static_cast<size_t>(key ^ (key >> 32));
+    }
+    void rehash(size_t capacity);
+};
+
+#endif
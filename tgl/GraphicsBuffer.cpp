@@ -0,0 +1,112 @@
+#include "GraphicsBuffer.h"
+#include "GraphicsRecorder.h"
+#include "FontAtlas.h"
+#include <algorithm>
+
+GraphicsBuffer::GraphicsBuffer(size_t regions)
+    : m_vbo(sizeof(Vertex), regions), m_vertBase(0),
+      m_rectVbo(sizeof(RectInstance), regions), m_rectOffset(0)
+{
+    glGenVertexArrays(1, &m_vao);
+    glGenVertexArrays(1, &m_rectVao);
+
+    // Set Glyph VAO ( the quad indices are bound by the renderer )
+    glBindVertexArray(m_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo.getBuffer());
+    glVertexAttribPointer(ATTRIB_POS, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          (void *)(offsetof(Vertex, pos)));
+    glVertexAttribPointer(ATTRIB_UV0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          (void *)(offsetof(Vertex, uv0)));
+    glVertexAttribPointer(ATTRIB_UV1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          (void *)(offsetof(Vertex, uv1)));
+    glVertexAttribPointer(ATTRIB_PAGE, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                          (void *)(offsetof(Vertex, page)));
+    glEnableVertexAttribArray(ATTRIB_POS);
+    glEnableVertexAttribArray(ATTRIB_UV0);
+    glEnableVertexAttribArray(ATTRIB_UV1);
+    glEnableVertexAttribArray(ATTRIB_PAGE);
+
+    // Set Rect VAO ( pointers are set per call, see GraphicsRenderer::renderBuffer() )
+    glBindVertexArray(m_rectVao);
+    glVertexAttribDivisor(ATTRIB_RECT_POS, 1);
+    glVertexAttribDivisor(ATTRIB_RECT_UV0, 1);
+    glEnableVertexAttribArray(ATTRIB_RECT_POS);
+    glEnableVertexAttribArray(ATTRIB_RECT_UV0);
+    glBindVertexArray(0);
+}
+
+GraphicsBuffer::~GraphicsBuffer()
+{
+    glDeleteVertexArrays(1, &m_vao);
+    glDeleteVertexArrays(1, &m_rectVao);
+    for (const ShelfPins &pins : m_shelfPins)
+        pins.atlas->unpinShelves(pins.shelves, pins.epoch);
+}
+
+void GraphicsBuffer::pinFontShelves(const GraphicsRecorder &recorder)
+{
+    for (const std::shared_ptr<FontAtlas> &atlas : recorder.m_fontAtlases)
+    {
+        std::vector<int> shelves;
+        for (const std::pair<const FontAtlas *, int> &shelf : recorder.m_fontShelves)
+            if (shelf.first == atlas.get())
+                shelves.push_back(shelf.second);
+        if (shelves.empty())
+            continue;
+        std::sort(shelves.begin(), shelves.end());
+        shelves.erase(std::unique(shelves.begin(), shelves.end()), shelves.end());
+        const uint64_t epoch = atlas->pinShelves(shelves);
+        m_shelfPins.push_back(ShelfPins{atlas, std::move(shelves), epoch});
+    }
+}
+
+void GraphicsBuffer::upload(const GraphicsRecorder &recorder)
+{
+    stream(recorder);
+
+    // Upload calls
+    m_calls = recorder.m_calls;
+    if (m_calls.size() < m_calls.capacity() / 4)
+        m_calls.shrink_to_fit();
+
+    // Upload states
+    m_states = recorder.m_states;
+    if (m_states.size() < m_states.capacity() / 4)
+        m_states.shrink_to_fit();
+
+    // Upload pictures ( already on the GPU, only referenced )
+    m_pictures = recorder.m_pictures;
+    if (m_pictures.size() < m_pictures.capacity() / 4)
+        m_pictures.shrink_to_fit();
+}
+
+void GraphicsBuffer::upload(GraphicsRecorder &&recorder)
+{
+    stream(recorder);
+
+    // Last frame's storage goes back to the recorder, clear() keeps its capacity
+    m_calls.swap(recorder.m_calls);
+    m_states.swap(recorder.m_states);
+    m_pictures.swap(recorder.m_pictures);
+    recorder.clear();
+}
+
+void GraphicsBuffer::stream(const GraphicsRecorder &recorder)
+{
+    // Upload fonts
+    recorder.syncFontTextures();
+
+    // Stream rect instances
+    const std::vector<RectInstance> &rects = recorder.m_rects;
+    m_rectOffset = m_rectVbo.write(rects.data(), rects.size() * sizeof(RectInstance));
+
+    // Stream vertices
+    const std::vector<Vertex> &verts = recorder.m_verts;
+    m_vertBase = static_cast<GLint>(m_vbo.write(verts.data(), verts.size() * sizeof(Vertex)) / sizeof(Vertex));
+}
+
+void GraphicsBuffer::fence()
+{
+    m_rectVbo.fence();
+    m_vbo.fence();
+}
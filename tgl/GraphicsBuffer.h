@@ -0,0 +1,75 @@
+#ifndef GRAPHICSBUFFER_H
+#define GRAPHICSBUFFER_H
+
+#include "GraphicsStructs.h"
+#include "StreamBuffer.h"
+#include "OpenGLHeader.h"
+#include <memory>
+#include <vector>
+#include <cstddef>
+
+class GraphicsRecorder;
+class FontAtlas;
+
+//
+// GraphicsBuffer
+//
+// GPU side of a recording: rect instances and glyph vertices in their own
+// VBOs, with the calls and states that draw them. Owned by the renderer for
+// the frame and shared by pictures for retained content.
+class GraphicsBuffer
+{
+public:
+    // Regions of the streaming VBOs, 1 for content uploaded once
+    GraphicsBuffer(size_t regions = StreamBuffer::DEFAULT_REGIONS);
+    ~GraphicsBuffer();
+
+    GraphicsBuffer(const GraphicsBuffer &) = delete;
+    GraphicsBuffer &operator=(const GraphicsBuffer &) = delete;
+
+    // Uploads fonts, primitives and calls of the recorder, GL thread only
+    void upload(const GraphicsRecorder &recorder);
+    // Same, but swaps calls with this buffer's previous ones instead of copying
+    // them, and leaves the recorder cleared with its storage kept for reuse
+    void upload(GraphicsRecorder &&recorder);
+    // Called after the draws reading the last upload were issued
+    void fence();
+
+    inline const Bounds &getBounds() const { return m_bounds; }
+
+private:
+    void stream(const GraphicsRecorder &recorder);
+
+    // Glyph VBO & VAO ( indexed by the renderer's shared quad indices )
+    StreamBuffer m_vbo;
+    GLint m_vertBase; // First vertex of the last upload
+    GLuint m_vao;
+
+    // Rect Instances VBO & VAO
+    StreamBuffer m_rectVbo;
+    size_t m_rectOffset; // Byte offset of the last upload
+    GLuint m_rectVao;
+
+    // Calls
+    std::vector<Call> m_calls;
+    std::vector<CallState> m_states;
+    std::vector<PictureInstance> m_pictures;
+
+    // Drawn area in local coordinates, scissors ignored ( set for pictures only )
+    Bounds m_bounds;
+
+    // LRU shelves the glyphs of a picture sample, pinned while the buffer lives
+    struct ShelfPins
+    {
+        std::shared_ptr<FontAtlas> atlas;
+        std::vector<int> shelves;
+        uint64_t epoch;
+    };
+    std::vector<ShelfPins> m_shelfPins;
+    void pinFontShelves(const GraphicsRecorder &recorder);
+
+    friend class GraphicsRenderer;
+    friend class GraphicsPicture;
+};
+
+#endif
@@ -0,0 +1,10 @@
+#include "GraphicsPicture.h"
+#include "GraphicsRecorder.h"
+
+GraphicsPicture::GraphicsPicture(const GraphicsRecorder &recorder)
+{
+    m_buffer = std::make_shared<GraphicsBuffer>(1);
+    m_buffer->upload(recorder);
+    m_buffer->pinFontShelves(recorder);
+    m_buffer->m_bounds = recorder.bounds();
+}
@@ -0,0 +1,32 @@
+#ifndef GRAPHICSPICTURE_H
+#define GRAPHICSPICTURE_H
+
+#include "GraphicsBuffer.h"
+#include <memory>
+
+class GraphicsRecorder;
+
+//
+// GraphicsPicture
+//
+// Content recorded once and kept on the GPU. Drawn into later recordings with
+// GraphicsRecorder::drawPicture() at any offset and scale, its primitives are
+// neither rebuilt nor uploaded again.
+class GraphicsPicture
+{
+public:
+    GraphicsPicture() {};
+    // Uploads the recorder's current content, GL thread only
+    GraphicsPicture(const GraphicsRecorder &recorder);
+    ~GraphicsPicture() = default;
+
+    // Getters
+    inline const Bounds &getBounds() const { return m_buffer->getBounds(); }
+    inline bool isValid() const { return m_buffer != nullptr; }
+
+private:
+    std::shared_ptr<GraphicsBuffer> m_buffer = nullptr;
+    friend class GraphicsRecorder;
+};
+
+#endif
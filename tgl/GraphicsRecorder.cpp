@@ -1,73 +1,106 @@
 #include "GraphicsRecorder.h"
 #include "FontAtlas.h"
-#include <locale>
-#include <codecvt>
+#include "Utf8.h"
+#include <algorithm>
+#include <cassert>
 
 constexpr float FLOAT_EPSILON = 1e-6f;
+constexpr float RECT_FRINGE = 1.0f; // Must match RECT_FRINGE in the renderer's vertex shader
+constexpr float CULL_MARGIN = 2.0f; // RECT_FRINGE plus the scissor() falloff in the fragment shader
+constexpr size_t BATCH_GRID_SIZE = 64;
+
+std::atomic<uint64_t> GraphicsRecorder::RecorderId::s_next{1};
 
 GraphicsRecorder::GraphicsRecorder()
 {
-    // Initialize Calls
-    Call call;
+    // Initialize State
     // blend: source-over
-    call.state.sfactor = GL_ONE;
-    call.state.dfactor = GL_ONE_MINUS_SRC_ALPHA;
+    m_callState.sfactor = GL_ONE;
+    m_callState.dfactor = GL_ONE_MINUS_SRC_ALPHA;
     // alpha: 1.0f
-    call.state.alpha = 1.0f;
+    m_callState.alpha = 1.0f;
     // scissor: none
-    call.state.scissor.minx = -std::numeric_limits<float>::infinity();
-    call.state.scissor.miny = -std::numeric_limits<float>::infinity();
-    call.state.scissor.maxx = +std::numeric_limits<float>::infinity();
-    call.state.scissor.maxy = +std::numeric_limits<float>::infinity();
+    m_callState.scissor.minx = -std::numeric_limits<float>::infinity();
+    m_callState.scissor.miny = -std::numeric_limits<float>::infinity();
+    m_callState.scissor.maxx = +std::numeric_limits<float>::infinity();
+    m_callState.scissor.maxy = +std::numeric_limits<float>::infinity();
     // fill: none
-    call.state.fillType = FILL_NONE;
+    m_callState.fillType = FILL_NONE;
+
+    // Initialize Viewport
+    unsetViewport();
+
+    // Initialize Calls
+    Call call;
     // draw: rect
-    call.param.drawType = DRAW_RECT;
-    // indice: 0, 0
-    call.indiceOffset = reinterpret_cast<void *>(0);
-    call.indiceCount = 0;
+    call.drawType = DRAW_RECT;
+    // state: none
+    call.stateId = INVALID_STATE_ID;
+    // primitive: 0, 0
+    call.first = 0;
+    call.count = 0;
     m_currentCall = &m_calls.emplace_back(call);
 }
 
 void GraphicsRecorder::clear()
 {
     Call call;
-    call.state = m_currentCall->state;
-    call.param = m_currentCall->param;
-    call.indiceOffset = reinterpret_cast<void *>(0);
-    call.indiceCount = 0;
-    decltype(m_calls){}.swap(m_calls);
+    call.drawType = m_currentCall->drawType;
+    call.stateId = INVALID_STATE_ID;
+    call.first = 0;
+    call.count = 0;
+    if (m_calls.size() < m_calls.capacity() / 4)
+        decltype(m_calls){}.swap(m_calls);
+    else
+        m_calls.clear();
     m_currentCall = &m_calls.emplace_back(call);
+    m_generation += 1;
+
+    // Clear interned states
+    m_states.clear();
+    std::fill(m_stateSlots.begin(), m_stateSlots.end(), 0);
+    changeCallState();
+
+    // Keep only the current font
+    m_fontAtlases.clear();
+    m_fontShelves.clear();
+    m_uniqueFontShelves = 0;
+    if (m_drawState.fontAtlas != nullptr)
+        m_fontAtlases.push_back(m_drawState.fontAtlas);
 
     // Shrink state stack
     if (m_stateStack.size() < m_stateStack.capacity() / 4)
         m_stateStack.shrink_to_fit();
 
     // Clear buffers
+    if (m_rects.size() < m_rects.capacity() / 4)
+        decltype(m_rects){}.swap(m_rects);
+    else
+        m_rects.clear();
+
     if (m_verts.size() < m_verts.capacity() / 4)
         decltype(m_verts){}.swap(m_verts);
     else
         m_verts.clear();
 
-    if (m_indices.size() < m_indices.capacity() / 4)
-        decltype(m_indices){}.swap(m_indices);
+    if (m_pictures.size() < m_pictures.capacity() / 4)
+        decltype(m_pictures){}.swap(m_pictures);
     else
-        m_indices.clear();
+        m_pictures.clear();
 }
 
 void GraphicsRecorder::save()
 {
-    syncFontTexture();
-    m_stateStack.push_back(State{m_currentCall->state, m_drawState});
+    m_stateStack.push_back(State{m_callState, m_drawState});
 }
 
 void GraphicsRecorder::restore()
 {
     if (!m_stateStack.empty())
     {
-        switchToNewActiveCall();
+        changeCallState();
         State &state = m_stateStack.back();
-        m_currentCall->state = state.callState;
+        m_callState = state.callState;
         m_drawState = state.drawState;
         m_stateStack.pop_back();
     }
@@ -139,35 +172,35 @@ void GraphicsRecorder::setCompositeOperation(CompositeOperation compositeOperati
         dfactor = GL_ONE_MINUS_SRC_ALPHA;
         break;
     }
-    if (m_currentCall->state.sfactor != sfactor || m_currentCall->state.dfactor != dfactor)
+    if (m_callState.sfactor != sfactor || m_callState.dfactor != dfactor)
     {
-        switchToNewActiveCall();
-        m_currentCall->state.sfactor = sfactor;
-        m_currentCall->state.dfactor = dfactor;
+        changeCallState();
+        m_callState.sfactor = sfactor;
+        m_callState.dfactor = dfactor;
     }
 }
 
 void GraphicsRecorder::setCompositeGlobalAlpha(float alpha)
 {
-    if (std::abs(m_currentCall->state.alpha - alpha) > FLOAT_EPSILON)
+    if (std::abs(m_callState.alpha - alpha) > FLOAT_EPSILON)
     {
-        switchToNewActiveCall();
-        m_currentCall->state.alpha = alpha;
+        changeCallState();
+        m_callState.alpha = alpha;
     }
 }
 
 void GraphicsRecorder::setFillColor(const Color &color)
 {
     Color premultipliedColor = Color::premulColor(color);
-    if (m_currentCall->state.fillType != FILL_COLOR ||
-        std::abs(m_currentCall->state.color.r - premultipliedColor.r) > FLOAT_EPSILON ||
-        std::abs(m_currentCall->state.color.g - premultipliedColor.g) > FLOAT_EPSILON ||
-        std::abs(m_currentCall->state.color.b - premultipliedColor.b) > FLOAT_EPSILON ||
-        std::abs(m_currentCall->state.color.a - premultipliedColor.a) > FLOAT_EPSILON)
-    {
-        switchToNewActiveCall();
-        m_currentCall->state.fillType = FILL_COLOR;
-        m_currentCall->state.color = premultipliedColor;
+    if (m_callState.fillType != FILL_COLOR ||
+        std::abs(m_callState.color.r - premultipliedColor.r) > FLOAT_EPSILON ||
+        std::abs(m_callState.color.g - premultipliedColor.g) > FLOAT_EPSILON ||
+        std::abs(m_callState.color.b - premultipliedColor.b) > FLOAT_EPSILON ||
+        std::abs(m_callState.color.a - premultipliedColor.a) > FLOAT_EPSILON)
+    {
+        changeCallState();
+        m_callState.fillType = FILL_COLOR;
+        m_callState.color = premultipliedColor;
     }
 }
 
@@ -176,14 +209,14 @@ void GraphicsRecorder::setFillImage(const Image &image)
     if (!image.isValid())
         return;
     uint32_t imageParams = (image.m_layout << 16) | image.m_flags;
-    if (m_currentCall->state.fillType != FILL_IMAGE ||
-        m_currentCall->state.texture != image.m_texture ||
-        m_currentCall->state.imageParams != imageParams)
-    {
-        switchToNewActiveCall();
-        m_currentCall->state.fillType = FILL_IMAGE;
-        m_currentCall->state.imageParams = imageParams;
-        m_currentCall->state.texture = image.m_texture;
+    if (m_callState.fillType != FILL_IMAGE ||
+        m_callState.texture != image.m_texture ||
+        m_callState.imageParams != imageParams)
+    {
+        changeCallState();
+        m_callState.fillType = FILL_IMAGE;
+        m_callState.imageParams = imageParams;
+        m_callState.texture = image.m_texture;
         m_drawState.imageClip = Image::CLIP_NONE;
     }
 }
@@ -197,20 +230,22 @@ void GraphicsRecorder::setFillLinearGradient(const Gradient &gradient, float x0,
 {
     if (!gradient.isValid())
         return;
-    if (m_currentCall->state.fillType != FILL_LINEAR_GRADIENT ||
-        m_currentCall->state.texture != gradient.m_texture ||
-        std::fabs(m_currentCall->state.gradientParam0[0] - x0) > FLOAT_EPSILON ||
-        std::fabs(m_currentCall->state.gradientParam0[1] - y0) > FLOAT_EPSILON ||
-        std::fabs(m_currentCall->state.gradientParam1[0] - x1) > FLOAT_EPSILON ||
-        std::fabs(m_currentCall->state.gradientParam1[1] - y1) > FLOAT_EPSILON)
-    {
-        switchToNewActiveCall();
-        m_currentCall->state.fillType = FILL_LINEAR_GRADIENT;
-        m_currentCall->state.gradientParam0[0] = x0;
-        m_currentCall->state.gradientParam0[1] = y0;
-        m_currentCall->state.gradientParam1[0] = x1;
-        m_currentCall->state.gradientParam1[1] = y1;
-        m_currentCall->state.texture = gradient.m_texture;
+    if (m_callState.fillType != FILL_LINEAR_GRADIENT ||
+        m_callState.texture != gradient.m_texture ||
+        std::fabs(m_callState.gradientParam0[0] - x0) > FLOAT_EPSILON ||
+        std::fabs(m_callState.gradientParam0[1] - y0) > FLOAT_EPSILON ||
+        std::fabs(m_callState.gradientParam1[0] - x1) > FLOAT_EPSILON ||
+        std::fabs(m_callState.gradientParam1[1] - y1) > FLOAT_EPSILON)
+    {
+        changeCallState();
+        m_callState.fillType = FILL_LINEAR_GRADIENT;
+        m_callState.gradientParam0[0] = x0;
+        m_callState.gradientParam0[1] = y0;
+        m_callState.gradientParam0[2] = 0.0f;
+        m_callState.gradientParam1[0] = x1;
+        m_callState.gradientParam1[1] = y1;
+        m_callState.gradientParam1[2] = 0.0f;
+        m_callState.texture = gradient.m_texture;
     }
 }
 
@@ -220,24 +255,24 @@ void GraphicsRecorder::setFillRadialGradient(const Gradient &gradient,
 {
     if (!gradient.isValid())
         return;
-    if (m_currentCall->state.fillType != FILL_RADIAL_GRADIENT ||
-        m_currentCall->state.texture != gradient.m_texture ||
-        std::fabs(m_currentCall->state.gradientParam0[0] - x0) > FLOAT_EPSILON ||
-        std::fabs(m_currentCall->state.gradientParam0[1] - y0) > FLOAT_EPSILON ||
-        std::fabs(m_currentCall->state.gradientParam0[2] - r0) > FLOAT_EPSILON ||
-        std::fabs(m_currentCall->state.gradientParam1[0] - x1) > FLOAT_EPSILON ||
-        std::fabs(m_currentCall->state.gradientParam1[1] - y1) > FLOAT_EPSILON ||
-        std::fabs(m_currentCall->state.gradientParam1[2] - r1) > FLOAT_EPSILON)
-    {
-        switchToNewActiveCall();
-        m_currentCall->state.fillType = FILL_RADIAL_GRADIENT;
-        m_currentCall->state.gradientParam0[0] = x0;
-        m_currentCall->state.gradientParam0[1] = y0;
-        m_currentCall->state.gradientParam0[2] = r0;
-        m_currentCall->state.gradientParam1[0] = x1;
-        m_currentCall->state.gradientParam1[1] = y1;
-        m_currentCall->state.gradientParam1[2] = r1;
-        m_currentCall->state.texture = gradient.m_texture;
+    if (m_callState.fillType != FILL_RADIAL_GRADIENT ||
+        m_callState.texture != gradient.m_texture ||
+        std::fabs(m_callState.gradientParam0[0] - x0) > FLOAT_EPSILON ||
+        std::fabs(m_callState.gradientParam0[1] - y0) > FLOAT_EPSILON ||
+        std::fabs(m_callState.gradientParam0[2] - r0) > FLOAT_EPSILON ||
+        std::fabs(m_callState.gradientParam1[0] - x1) > FLOAT_EPSILON ||
+        std::fabs(m_callState.gradientParam1[1] - y1) > FLOAT_EPSILON ||
+        std::fabs(m_callState.gradientParam1[2] - r1) > FLOAT_EPSILON)
+    {
+        changeCallState();
+        m_callState.fillType = FILL_RADIAL_GRADIENT;
+        m_callState.gradientParam0[0] = x0;
+        m_callState.gradientParam0[1] = y0;
+        m_callState.gradientParam0[2] = r0;
+        m_callState.gradientParam1[0] = x1;
+        m_callState.gradientParam1[1] = y1;
+        m_callState.gradientParam1[2] = r1;
+        m_callState.texture = gradient.m_texture;
     }
 }
 
@@ -245,37 +280,54 @@ void GraphicsRecorder::setFillConicGradient(const Gradient &gradient, float star
 {
     if (!gradient.isValid())
         return;
-    if (m_currentCall->state.fillType != FILL_CONIC_GRADIENT ||
-        m_currentCall->state.texture != gradient.m_texture ||
-        std::fabs(m_currentCall->state.gradientParam0[0] - x) > FLOAT_EPSILON ||
-        std::fabs(m_currentCall->state.gradientParam0[1] - y) > FLOAT_EPSILON ||
-        std::fabs(m_currentCall->state.gradientParam0[2] - startAngle) > FLOAT_EPSILON)
-    {
-        switchToNewActiveCall();
-        m_currentCall->state.fillType = FILL_CONIC_GRADIENT;
-        m_currentCall->state.gradientParam0[0] = x;
-        m_currentCall->state.gradientParam0[1] = y;
-        m_currentCall->state.gradientParam0[2] = startAngle;
-        m_currentCall->state.texture = gradient.m_texture;
+    if (m_callState.fillType != FILL_CONIC_GRADIENT ||
+        m_callState.texture != gradient.m_texture ||
+        std::fabs(m_callState.gradientParam0[0] - x) > FLOAT_EPSILON ||
+        std::fabs(m_callState.gradientParam0[1] - y) > FLOAT_EPSILON ||
+        std::fabs(m_callState.gradientParam0[2] - startAngle) > FLOAT_EPSILON)
+    {
+        changeCallState();
+        m_callState.fillType = FILL_CONIC_GRADIENT;
+        m_callState.gradientParam0[0] = x;
+        m_callState.gradientParam0[1] = y;
+        m_callState.gradientParam0[2] = startAngle;
+        std::fill(m_callState.gradientParam1, m_callState.gradientParam1 + 3, 0.0f);
+        m_callState.texture = gradient.m_texture;
     }
 }
 
 void GraphicsRecorder::setScissor(float x, float y, float width, float height)
 {
-    switchToNewActiveCall();
-    m_currentCall->state.scissor.minx = x;
-    m_currentCall->state.scissor.miny = y;
-    m_currentCall->state.scissor.maxx = x + width;
-    m_currentCall->state.scissor.maxy = y + height;
+    changeCallState();
+    m_callState.scissor.minx = x;
+    m_callState.scissor.miny = y;
+    m_callState.scissor.maxx = x + width;
+    m_callState.scissor.maxy = y + height;
 }
 
 void GraphicsRecorder::unsetScissor()
 {
-    switchToNewActiveCall();
-    m_currentCall->state.scissor.minx = -std::numeric_limits<float>::infinity();
-    m_currentCall->state.scissor.miny = -std::numeric_limits<float>::infinity();
-    m_currentCall->state.scissor.maxx = +std::numeric_limits<float>::infinity();
-    m_currentCall->state.scissor.maxy = +std::numeric_limits<float>::infinity();
+    changeCallState();
+    m_callState.scissor.minx = -std::numeric_limits<float>::infinity();
+    m_callState.scissor.miny = -std::numeric_limits<float>::infinity();
+    m_callState.scissor.maxx = +std::numeric_limits<float>::infinity();
+    m_callState.scissor.maxy = +std::numeric_limits<float>::infinity();
+}
+
+void GraphicsRecorder::setViewport(float x, float y, float width, float height)
+{
+    m_viewport.minx = x;
+    m_viewport.miny = y;
+    m_viewport.maxx = x + width;
+    m_viewport.maxy = y + height;
+}
+
+void GraphicsRecorder::unsetViewport()
+{
+    m_viewport.minx = -std::numeric_limits<float>::infinity();
+    m_viewport.miny = -std::numeric_limits<float>::infinity();
+    m_viewport.maxx = +std::numeric_limits<float>::infinity();
+    m_viewport.maxy = +std::numeric_limits<float>::infinity();
 }
 
 void GraphicsRecorder::drawRect(float x, float y, float width, float height)
@@ -286,7 +338,7 @@ void GraphicsRecorder::drawRect(float x, float y, float width, float height)
 
 void GraphicsRecorder::drawImage(float dx, float dy, float scale)
 {
-    CallState &state = m_currentCall->state;
+    CallState &state = m_callState;
     if (state.fillType != FILL_IMAGE)
         return;
 
@@ -298,10 +350,31 @@ void GraphicsRecorder::drawImage(float dx, float dy, float scale)
     buildRectBounds(posb, uv0b);
 }
 
+void GraphicsRecorder::drawPicture(const GraphicsPicture &picture, float dx, float dy, float scale)
+{
+    if (!picture.isValid() || scale <= 0.0f)
+        return;
+    const Bounds &b = picture.getBounds();
+    const Bounds cull = cullBounds();
+    if (b.maxx * scale + dx <= cull.minx || b.minx * scale + dx >= cull.maxx ||
+        b.maxy * scale + dy <= cull.miny || b.miny * scale + dy >= cull.maxy)
+        return;
+    if (m_rectStateId == INVALID_STATE_ID)
+        m_rectStateId = internCallState(m_callState, nullptr);
+    switchToCall(DRAW_PICTURE, m_rectStateId);
+    if (m_currentCall->count == 0)
+        m_currentCall->first = static_cast<GLint>(m_pictures.size());
+
+    m_pictures.push_back(PictureInstance{picture.m_buffer, dx, dy, scale});
+    m_currentCall->count += 1;
+    m_generation += 1;
+}
+
 void GraphicsRecorder::setFontFamily(const Font &font)
 {
-    syncFontTexture();
     m_drawState.fontAtlas = font.m_atlas;
+    if (std::find(m_fontAtlases.begin(), m_fontAtlases.end(), font.m_atlas) == m_fontAtlases.end())
+        m_fontAtlases.push_back(font.m_atlas);
 }
 
 void GraphicsRecorder::setFontPixelSize(size_t pixelSize)
@@ -313,129 +386,724 @@ void GraphicsRecorder::setFontPixelSize(size_t pixelSize)
     m_drawState.fontPixelSize = pixelSize;
 }
 
-void GraphicsRecorder::drawText(float x, float y, const std::string &utf8string)
+void GraphicsRecorder::setTextRunCacheCapacity(size_t runs)
+{
+    m_textRuns.setCapacity(runs);
+}
+
+// Wide and UTF-32 strings hold one codepoint per character
+template <typename Char, typename Fn>
+static inline void forEachChar(std::string_view bytes, Fn &&fn)
+{
+    const Char *chars = reinterpret_cast<const Char *>(bytes.data());
+    const size_t count = bytes.size() / sizeof(Char);
+    for (size_t i = 0; i < count; ++i)
+        if (!fn(static_cast<uint32_t>(chars[i])))
+            return;
+}
+
+template <typename Fn>
+static inline void forEachEncodedCodepoint(uint32_t encoding, std::string_view bytes, Fn &&fn)
+{
+    switch (encoding)
+    {
+    case GraphicsRecorder::ENCODING_UTF8:
+        Utf8::forEachCodepoint(bytes.data(), bytes.size(), fn);
+        break;
+    case GraphicsRecorder::ENCODING_WCHAR:
+        forEachChar<wchar_t>(bytes, fn);
+        break;
+    case GraphicsRecorder::ENCODING_UTF32:
+        forEachChar<char32_t>(bytes, fn);
+        break;
+    }
+}
+
+template <typename Char>
+static inline std::string_view asBytes(std::basic_string_view<Char> string)
+{
+    return std::string_view(reinterpret_cast<const char *>(string.data()), string.size() * sizeof(Char));
+}
+
+void GraphicsRecorder::drawText(float x, float y, std::string_view utf8string)
+{
+    drawEncodedText(x, y, ENCODING_UTF8, utf8string);
+}
+
+#ifdef __cpp_char8_t
+void GraphicsRecorder::drawText(float x, float y, std::u8string_view utf8string)
+{
+    drawEncodedText(x, y, ENCODING_UTF8, asBytes(utf8string));
+}
+#endif
+
+void GraphicsRecorder::drawText(float x, float y, std::wstring_view utf16string)
+{
+    drawEncodedText(x, y, ENCODING_WCHAR, asBytes(utf16string));
+}
+
+void GraphicsRecorder::drawText(float x, float y, std::u32string_view utf32string)
+{
+    drawEncodedText(x, y, ENCODING_UTF32, asBytes(utf32string));
+}
+
+GraphicsRecorder::TextMetrics GraphicsRecorder::measureText(std::string_view utf8string)
+{
+    return measureEncodedText(ENCODING_UTF8, utf8string);
+}
+
+#ifdef __cpp_char8_t
+GraphicsRecorder::TextMetrics GraphicsRecorder::measureText(std::u8string_view utf8string)
+{
+    return measureEncodedText(ENCODING_UTF8, asBytes(utf8string));
+}
+#endif
+
+GraphicsRecorder::TextMetrics GraphicsRecorder::measureText(std::wstring_view utf16string)
 {
-    std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
-    return drawText(x, y, converter.from_bytes(utf8string));
+    return measureEncodedText(ENCODING_WCHAR, asBytes(utf16string));
 }
 
-void GraphicsRecorder::drawText(float x, float y, const std::wstring &utf16string)
+GraphicsRecorder::TextMetrics GraphicsRecorder::measureText(std::u32string_view utf32string)
+{
+    return measureEncodedText(ENCODING_UTF32, asBytes(utf32string));
+}
+
+void GraphicsRecorder::drawEncodedText(float x, float y, TextEncoding encoding, std::string_view bytes)
 {
     if (m_drawState.fontAtlas == nullptr)
         return;
     FontAtlas &atlas = *(m_drawState.fontAtlas);
-    for (wchar_t ch : utf16string)
+    const size_t pixelSize = m_drawState.fontPixelSize;
+
+    // Skip lines outside the viewport and scissor, and glyphs past the right edge
+    const Bounds cull = cullBounds();
+    const Bounds extents = atlas.extents(pixelSize);
+    if (y + extents.maxy <= cull.miny || y + extents.miny >= cull.maxy)
+        return;
+
+    // Hits only read the atlas, so recorders on other threads may share it
+    std::shared_lock<std::shared_mutex> lock(atlas.mutex());
+    const DrawType drawType = atlas.isSdf() ? DRAW_FONT_SDF : DRAW_FONT;
+
+    // Cached run, valid while the atlas kept its glyphs where they were: no reset,
+    // and none of the run's shelves evicted since
+    TextRunCache::Run *run = m_textRuns.find(encoding, bytes, atlas.id(), pixelSize);
+    bool runValid = run != nullptr && run->atlasGeneration == atlas.generation();
+    for (size_t i = 0; runValid && i < run->shelves.size(); ++i)
+        runValid = atlas.shelfEpoch(run->shelves[i]) == run->shelfEpochs[i];
+    if (runValid)
+    {
+        for (int shelf : run->shelves)
+        {
+            atlas.touchShelf(shelf);
+            m_fontShelves.emplace_back(&atlas, shelf);
+        }
+        compactFontShelves();
+        emitTextRun(*run, x, y, atlas.getTexture(), drawType);
+        return;
+    }
+
+    // Glyphs of SDF atlases are stored at one size and scaled here
+    const size_t glyphSize = atlas.glyphPixelSize(pixelSize);
+    const float scale = static_cast<float>(pixelSize) / glyphSize;
+    const float border = atlas.glyphBorder() * scale;
+
+    // Rasterize the glyphs missing up to the right edge in one batch, advances
+    // of glyphs never seen are unknown and count as zero
+    float penX = x;
+    m_missingGlyphs.clear();
+    auto collectCodepoint = [&](uint32_t ch)
     {
-        GlyphValue *glyph = m_drawState.fontAtlas->glyph(ch, m_drawState.fontPixelSize);
+        if (penX + extents.minx >= cull.maxx)
+            return false;
+        const GlyphValue *glyph = atlas.findGlyph(ch, glyphSize);
         if (glyph == nullptr)
         {
-            atlas.syncTexture();
-            atlas.reset();
-            glyph = m_drawState.fontAtlas->glyph(ch, m_drawState.fontPixelSize);
+            m_missingGlyphs.push_back(ch);
+            glyph = atlas.findMetrics(ch, glyphSize);
+        }
+        if (glyph != nullptr)
+            penX += glyph->advance * scale;
+        return true;
+    };
+    forEachEncodedCodepoint(encoding, bytes, collectCodepoint);
+    if (!m_missingGlyphs.empty())
+    {
+        lock.unlock();
+        atlas.prepareGlyphs(m_missingGlyphs.data(), m_missingGlyphs.size(), glyphSize);
+        lock.lock();
+    }
+
+    // Lay out, keeping the glyphs for the cache
+    const float originX = x;
+    const uint64_t generation = atlas.generation();
+    const uint64_t evictions = atlas.evictions();
+    bool complete = true;
+    float ascent = 0.0f;
+    float descent = 0.0f;
+    m_runGlyphs.clear();
+    m_runShelves.clear();
+    auto emitGlyph = [&](const GlyphValue *glyph)
+    {
+        const float baseX = x + glyph->bearingX * scale;
+        const float baseY = y - glyph->bearingY * scale;
+        const Bounds posb{baseX - border, baseY - border,
+                          baseX + glyph->width * scale + border, baseY + glyph->height * scale + border};
+        const float page = static_cast<float>(glyph->page);
+        buildFontBounds(posb, m_drawState.imageClip.uv0b, glyph->textureUV, page, atlas.getTexture(), drawType);
+        m_runGlyphs.push_back({Bounds{posb.minx - originX, posb.miny - y, posb.maxx - originX, posb.maxy - y},
+                               glyph->textureUV, page});
+        if (glyph->shelf >= 0)
+            m_runShelves.push_back(glyph->shelf);
+        ascent = std::max(ascent, glyph->bearingY * scale);
+        descent = std::max(descent, (glyph->height - glyph->bearingY) * scale);
+        x += glyph->advance * scale;
+    };
+    auto drawCodepoint = [&](uint32_t ch)
+    {
+        if (x + extents.minx >= cull.maxx)
+        {
+            complete = false;
+            return false;
+        }
+        const GlyphValue *glyph = atlas.findGlyph(ch, glyphSize);
+        if (glyph != nullptr)
+        {
+            emitGlyph(glyph);
+            return true;
+        }
+
+        // Miss: rasterize exclusively, resetting the atlas when it is full
+        lock.unlock();
+        {
+            std::unique_lock<std::shared_mutex> writeLock(atlas.mutex());
+            GlyphValue *newGlyph = atlas.glyph(ch, glyphSize);
+            if (newGlyph == nullptr)
+            {
+                atlas.reset();
+                newGlyph = atlas.glyph(ch, glyphSize);
+            }
+            emitGlyph(newGlyph);
         }
-        const float baseX = x + glyph->bearingX;
-        const float baseY = y - glyph->bearingY;
-        const Bounds posb{baseX, baseY, baseX + glyph->width, baseY + glyph->height};
-        buildFontBounds(posb, m_drawState.imageClip.uv0b, glyph->textureUV);
-        x += glyph->advance;
+        lock.lock();
+        return true;
+    };
+    forEachEncodedCodepoint(encoding, bytes, drawCodepoint);
+    std::sort(m_runShelves.begin(), m_runShelves.end());
+    m_runShelves.erase(std::unique(m_runShelves.begin(), m_runShelves.end()), m_runShelves.end());
+    for (int shelf : m_runShelves)
+        m_fontShelves.emplace_back(&atlas, shelf);
+    compactFontShelves();
+
+    // Only whole runs laid out without a reset or eviction meanwhile are kept
+    if (!complete || atlas.generation() != generation || atlas.evictions() != evictions ||
+        m_textRuns.getCapacity() == 0)
+        return;
+    if (run == nullptr)
+        run = &m_textRuns.insert(encoding, bytes, atlas.id(), pixelSize);
+    run->atlasGeneration = generation;
+    run->glyphs.assign(m_runGlyphs.begin(), m_runGlyphs.end());
+    run->shelves.assign(m_runShelves.begin(), m_runShelves.end());
+    run->shelfEpochs.clear();
+    for (int shelf : m_runShelves)
+        run->shelfEpochs.push_back(atlas.shelfEpoch(shelf));
+    run->bounds = Bounds{std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(),
+                         -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()};
+    for (const TextRunCache::Glyph &glyph : m_runGlyphs)
+    {
+        run->bounds.minx = std::min(run->bounds.minx, glyph.posb.minx);
+        run->bounds.miny = std::min(run->bounds.miny, glyph.posb.miny);
+        run->bounds.maxx = std::max(run->bounds.maxx, glyph.posb.maxx);
+        run->bounds.maxy = std::max(run->bounds.maxy, glyph.posb.maxy);
     }
+    run->width = x - originX;
+    run->ascent = ascent;
+    run->descent = descent;
 }
 
-GraphicsRecorder::TextMetrics GraphicsRecorder::measureText(const std::string &utf8string)
+void GraphicsRecorder::emitTextRun(const TextRunCache::Run &run, float x, float y,
+                                   const std::shared_ptr<Texture> &fontTexture, DrawType drawType)
 {
-    std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
-    return measureText(converter.from_bytes(utf8string));
+    const Bounds cull = cullBounds();
+    const Bounds runb{run.bounds.minx + x, run.bounds.miny + y, run.bounds.maxx + x, run.bounds.maxy + y};
+    if (runb.maxx <= cull.minx || runb.minx >= cull.maxx || runb.maxy <= cull.miny || runb.miny >= cull.maxy)
+        return;
+
+    const Bounds &uv0b = m_drawState.imageClip.uv0b;
+    if (runb.minx <= cull.minx || runb.maxx >= cull.maxx || runb.miny <= cull.miny || runb.maxy >= cull.maxy)
+    {
+        // Partly visible: cull per glyph
+        for (const TextRunCache::Glyph &glyph : run.glyphs)
+        {
+            const Bounds posb{glyph.posb.minx + x, glyph.posb.miny + y, glyph.posb.maxx + x, glyph.posb.maxy + y};
+            buildFontBounds(posb, uv0b, glyph.uv1b, glyph.page, fontTexture, drawType);
+        }
+        return;
+    }
+
+    // Fully visible: translated copy of the cached quads in one call
+    if (run.glyphs.empty())
+        return;
+    beginFontCall(fontTexture, drawType);
+    size_t vertex = m_verts.size();
+    m_verts.resize(vertex + run.glyphs.size() * 4);
+    for (const TextRunCache::Glyph &glyph : run.glyphs)
+    {
+        const Bounds posb{glyph.posb.minx + x, glyph.posb.miny + y, glyph.posb.maxx + x, glyph.posb.maxy + y};
+        const Bounds &uv1b = glyph.uv1b;
+        const float page = glyph.page;
+        m_verts[vertex++] = {Point{posb.minx, posb.miny}, Point{uv0b.minx, uv0b.miny}, Point{uv1b.minx, uv1b.miny}, page};
+        m_verts[vertex++] = {Point{posb.minx, posb.maxy}, Point{uv0b.minx, uv0b.maxy}, Point{uv1b.minx, uv1b.maxy}, page};
+        m_verts[vertex++] = {Point{posb.maxx, posb.maxy}, Point{uv0b.maxx, uv0b.maxy}, Point{uv1b.maxx, uv1b.maxy}, page};
+        m_verts[vertex++] = {Point{posb.maxx, posb.miny}, Point{uv0b.maxx, uv0b.miny}, Point{uv1b.maxx, uv1b.miny}, page};
+    }
+    m_currentCall->count += static_cast<GLsizei>(run.glyphs.size());
+    m_generation += 1;
 }
 
-GraphicsRecorder::TextMetrics GraphicsRecorder::measureText(const std::wstring &utf16string)
+GraphicsRecorder::TextMetrics GraphicsRecorder::measureEncodedText(TextEncoding encoding, std::string_view bytes)
 {
     if (m_drawState.fontAtlas == nullptr)
         return TextMetrics{};
     FontAtlas &atlas = *(m_drawState.fontAtlas);
+    const size_t pixelSize = m_drawState.fontPixelSize;
+
+    // Metrics of a cached run stay valid across atlas resets
+    std::shared_lock<std::shared_mutex> lock(atlas.mutex());
+    if (const TextRunCache::Run *run = m_textRuns.find(encoding, bytes, atlas.id(), pixelSize))
+        return TextMetrics{run->width, run->ascent, run->descent};
+
+    const size_t glyphSize = atlas.glyphPixelSize(pixelSize);
+    const float scale = static_cast<float>(pixelSize) / glyphSize;
     float width = 0.0f;
     float ascent = 0.0f;
     float descent = 0.0f;
-    for (wchar_t ch : utf16string)
+    auto measureCodepoint = [&](uint32_t ch)
     {
-        GlyphValue *glyph = m_drawState.fontAtlas->metrics(ch, m_drawState.fontPixelSize);
-        width += glyph->advance;
-        ascent = std::max(ascent, static_cast<float>(glyph->bearingY));
-        descent = std::max(descent, static_cast<float>(glyph->height - glyph->bearingY));
-    }
+        const GlyphValue *glyph = atlas.findMetrics(ch, glyphSize);
+        GlyphValue newGlyph;
+        if (glyph == nullptr)
+        {
+            lock.unlock();
+            {
+                std::unique_lock<std::shared_mutex> writeLock(atlas.mutex());
+                newGlyph = *atlas.metrics(ch, glyphSize);
+            }
+            lock.lock();
+            glyph = &newGlyph;
+        }
+        width += glyph->advance * scale;
+        ascent = std::max(ascent, glyph->bearingY * scale);
+        descent = std::max(descent, (glyph->height - glyph->bearingY) * scale);
+        return true;
+    };
+    forEachEncodedCodepoint(encoding, bytes, measureCodepoint);
     return TextMetrics{width, ascent, descent};
 }
 
-void GraphicsRecorder::switchToNewActiveCall()
+void GraphicsRecorder::append(const GraphicsRecorder &other)
 {
-    if (m_currentCall->indiceCount > 0)
+    // Reads other while growing this recorder's storage
+    assert(&other != this);
+
+    // Drop a trailing empty call, the appended ones follow directly
+    if (m_currentCall->count == 0 && m_calls.size() > 1)
+        m_calls.pop_back();
+
+    // Rebase primitives and remap states into this recorder's table
+    const GLint rectBase = static_cast<GLint>(m_rects.size());
+    const GLint vertBase = static_cast<GLint>(m_verts.size());
+    const GLint pictureBase = static_cast<GLint>(m_pictures.size());
+    std::vector<uint32_t> stateIds(other.m_states.size(), INVALID_STATE_ID);
+    for (const Call &otherCall : other.m_calls)
     {
-        Call call;
-        call.state = m_currentCall->state;
-        call.param = m_currentCall->param;
-        call.indiceOffset = reinterpret_cast<void *>(m_indices.size() * sizeof(GLuint));
-        call.indiceCount = 0;
-        m_currentCall = &m_calls.emplace_back(call);
+        if (otherCall.count == 0)
+            continue;
+        uint32_t &stateId = stateIds[otherCall.stateId];
+        if (stateId == INVALID_STATE_ID)
+        {
+            const CallState &state = other.m_states[otherCall.stateId];
+            stateId = internCallState(state, state.fontTexture);
+        }
+        Call &call = m_calls.emplace_back(otherCall);
+        call.stateId = stateId;
+        switch (call.drawType)
+        {
+        case DRAW_RECT:
+            call.first += rectBase;
+            break;
+        case DRAW_FONT:
+        case DRAW_FONT_SDF:
+            call.first += vertBase;
+            break;
+        case DRAW_PICTURE:
+            call.first += pictureBase;
+            break;
+        }
     }
+    m_rects.insert(m_rects.end(), other.m_rects.begin(), other.m_rects.end());
+    m_verts.insert(m_verts.end(), other.m_verts.begin(), other.m_verts.end());
+    m_pictures.insert(m_pictures.end(), other.m_pictures.begin(), other.m_pictures.end());
+
+    for (const std::shared_ptr<FontAtlas> &atlas : other.m_fontAtlases)
+        if (std::find(m_fontAtlases.begin(), m_fontAtlases.end(), atlas) == m_fontAtlases.end())
+            m_fontAtlases.push_back(atlas);
+    m_fontShelves.insert(m_fontShelves.end(), other.m_fontShelves.begin(), other.m_fontShelves.end());
+    compactFontShelves();
+
+    if (m_calls.empty())
+        m_calls.emplace_back(Call{DRAW_RECT, INVALID_STATE_ID, 0, 0});
+    m_currentCall = &m_calls.back();
+    m_generation += 1;
 }
 
-void GraphicsRecorder::switchToNewDrawTypeCall(DrawType drawType, bool extraCheck)
+void GraphicsRecorder::batch()
 {
-    if (m_currentCall->param.drawType != drawType || extraCheck)
+    // Collect primitives in painter's order
+    struct Primitive
+    {
+        Bounds bounds;
+        uint32_t call;
+        uint32_t index;
+        uint32_t next;
+    };
+    constexpr uint32_t NONE = ~0u;
+    std::vector<Primitive> prims;
+    prims.reserve(m_rects.size() + m_verts.size() / 4 + m_pictures.size());
+    Bounds total;
+    for (uint32_t c = 0; c < m_calls.size(); ++c)
+    {
+        const Call &call = m_calls[c];
+        for (GLsizei i = 0; i < call.count; ++i)
+        {
+            const Bounds bounds = primitiveBounds(call, i);
+            const bool isFont = call.drawType == DRAW_FONT || call.drawType == DRAW_FONT_SDF;
+            const uint32_t index = static_cast<uint32_t>(call.first + (isFont ? i * 4 : i));
+            prims.push_back(Primitive{bounds, c, index, NONE});
+            total = total + bounds;
+        }
+    }
+    if (prims.empty() || !std::isfinite(total.minx) || !std::isfinite(total.miny) ||
+        !std::isfinite(total.maxx) || !std::isfinite(total.maxy))
+        return;
+
+    // Uniform grid over the scene, each cell lists the primitives touching it
+    struct Entry
+    {
+        Bounds bounds;
+        uint32_t batch;
+    };
+    struct Cell
+    {
+        std::vector<Entry> entries;
+        uint32_t maxBatch = 0;
+    };
+    std::vector<Cell> grid(BATCH_GRID_SIZE * BATCH_GRID_SIZE);
+    const float cellW = std::max((total.maxx - total.minx) / BATCH_GRID_SIZE, 1.0f);
+    const float cellH = std::max((total.maxy - total.miny) / BATCH_GRID_SIZE, 1.0f);
+    auto cellRange = [&](const Bounds &b, size_t &x0, size_t &y0, size_t &x1, size_t &y1)
     {
-        switchToNewActiveCall();
-        m_currentCall->param.drawType = drawType;
+        auto clamp = [](float v)
+        { return static_cast<size_t>(std::clamp(v, 0.0f, BATCH_GRID_SIZE - 1.0f)); };
+        x0 = clamp((b.minx - total.minx) / cellW);
+        y0 = clamp((b.miny - total.miny) / cellH);
+        x1 = clamp((b.maxx - total.minx) / cellW);
+        y1 = clamp((b.maxy - total.miny) / cellH);
+    };
+    auto overlaps = [](const Bounds &a, const Bounds &b)
+    {
+        return a.minx < b.maxx && b.minx < a.maxx && a.miny < b.maxy && b.miny < a.maxy;
+    };
+
+    // Assign every primitive to a batch
+    struct Batch
+    {
+        DrawType drawType;
+        uint32_t stateId;
+        uint32_t head, tail;
+        GLsizei count;
+    };
+    std::vector<Batch> batches;
+    constexpr uint32_t DRAW_TYPES = DRAW_FONT_SDF + 1;
+    std::vector<uint32_t> latestBatch(m_states.size() * DRAW_TYPES, NONE); // by stateId and drawType
+    for (uint32_t p = 0; p < prims.size(); ++p)
+    {
+        Primitive &prim = prims[p];
+        const Call &call = m_calls[prim.call];
+        // Bounds that are not well formed ( NaN ) cover the whole scene, nothing moves across them
+        if (!(prim.bounds.minx <= prim.bounds.maxx && prim.bounds.miny <= prim.bounds.maxy))
+            prim.bounds = total;
+        uint32_t &latest = latestBatch[call.stateId * DRAW_TYPES + call.drawType];
+        size_t x0, y0, x1, y1;
+        cellRange(prim.bounds, x0, y0, x1, y1);
+
+        // Anything in a later batch overlapping this primitive pins it after that batch
+        bool movable = latest != NONE;
+        for (size_t y = y0; movable && y <= y1; ++y)
+            for (size_t x = x0; movable && x <= x1; ++x)
+            {
+                const Cell &cell = grid[y * BATCH_GRID_SIZE + x];
+                if (cell.maxBatch <= latest)
+                    continue;
+                for (const Entry &entry : cell.entries)
+                    if (entry.batch > latest && overlaps(entry.bounds, prim.bounds))
+                    {
+                        movable = false;
+                        break;
+                    }
+            }
+
+        if (!movable)
+        {
+            latest = static_cast<uint32_t>(batches.size());
+            batches.push_back(Batch{call.drawType, call.stateId, p, p, 0});
+        }
+        else
+        {
+            prims[batches[latest].tail].next = p;
+            batches[latest].tail = p;
+        }
+        batches[latest].count += 1;
+
+        for (size_t y = y0; y <= y1; ++y)
+            for (size_t x = x0; x <= x1; ++x)
+            {
+                Cell &cell = grid[y * BATCH_GRID_SIZE + x];
+                cell.entries.push_back(Entry{prim.bounds, latest});
+                cell.maxBatch = std::max(cell.maxBatch, latest);
+            }
+    }
+
+    // Rebuild calls and buffers in batch order
+    std::vector<RectInstance> rects;
+    std::vector<Vertex> verts;
+    std::vector<PictureInstance> pictures;
+    rects.reserve(m_rects.size());
+    verts.reserve(m_verts.size());
+    pictures.reserve(m_pictures.size());
+    m_calls.clear();
+    for (const Batch &batch : batches)
+    {
+        Call &call = m_calls.emplace_back();
+        call.drawType = batch.drawType;
+        call.stateId = batch.stateId;
+        call.count = batch.count;
+        switch (batch.drawType)
+        {
+        case DRAW_RECT:
+            call.first = static_cast<GLint>(rects.size());
+            for (uint32_t p = batch.head; p != NONE; p = prims[p].next)
+                rects.push_back(m_rects[prims[p].index]);
+            break;
+        case DRAW_FONT:
+        case DRAW_FONT_SDF:
+            call.first = static_cast<GLint>(verts.size());
+            for (uint32_t p = batch.head; p != NONE; p = prims[p].next)
+                verts.insert(verts.end(), &m_verts[prims[p].index], &m_verts[prims[p].index] + 4);
+            break;
+        case DRAW_PICTURE:
+            call.first = static_cast<GLint>(pictures.size());
+            for (uint32_t p = batch.head; p != NONE; p = prims[p].next)
+                pictures.push_back(std::move(m_pictures[prims[p].index]));
+            break;
+        }
+    }
+    m_rects.swap(rects);
+    m_verts.swap(verts);
+    m_pictures.swap(pictures);
+    m_currentCall = &m_calls.back();
+    m_generation += 1;
+}
+
+uint32_t GraphicsRecorder::internCallState(const CallState &callState, const std::shared_ptr<Texture> &fontTexture)
+{
+    // Open addressing, slots hold index + 1 into m_states
+    if ((m_states.size() + 1) * 2 > m_stateSlots.size())
+    {
+        m_stateSlots.assign(std::max<size_t>(m_stateSlots.size() * 2, 64), 0);
+        for (uint32_t id = 0; id < m_states.size(); ++id)
+        {
+            const size_t mask = m_stateSlots.size() - 1;
+            size_t slot = m_states[id].hash() & mask;
+            while (m_stateSlots[slot] != 0)
+                slot = (slot + 1) & mask;
+            m_stateSlots[slot] = id + 1;
+        }
+    }
+
+    const size_t mask = m_stateSlots.size() - 1;
+    const size_t hash = callState.hash();
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask)
+    {
+        const uint32_t id = m_stateSlots[slot];
+        if (id == 0)
+        {
+            CallState &state = m_states.emplace_back(callState);
+            state.fontTexture = fontTexture;
+            m_stateSlots[slot] = static_cast<uint32_t>(m_states.size());
+            return static_cast<uint32_t>(m_states.size() - 1);
+        }
+        const CallState &state = m_states[id - 1];
+        if (state.fontTexture == fontTexture && state.equals(callState))
+            return id - 1;
+    }
+}
+
+void GraphicsRecorder::switchToCall(DrawType drawType, uint32_t stateId)
+{
+    if (m_currentCall->drawType != drawType || m_currentCall->stateId != stateId)
+    {
+        if (m_currentCall->count > 0)
+            m_currentCall = &m_calls.emplace_back();
+        m_currentCall->drawType = drawType;
+        m_currentCall->stateId = stateId;
+        m_currentCall->first = 0;
+        m_currentCall->count = 0;
     }
 }
 
 void GraphicsRecorder::buildRectBounds(const Bounds &posb, const Bounds &uv0b)
 {
-    switchToNewDrawTypeCall(DRAW_RECT);
+    // Drop or trim against the viewport and scissor, inverted rects are kept as is
+    const Bounds cull = cullBounds();
+    Bounds pos = posb;
+    Bounds uv0 = uv0b;
+    if (posb.minx <= posb.maxx && posb.miny <= posb.maxy)
+    {
+        if (posb.maxx <= cull.minx || posb.minx >= cull.maxx ||
+            posb.maxy <= cull.miny || posb.miny >= cull.maxy)
+            return;
+        const float width = posb.maxx - posb.minx;
+        const float height = posb.maxy - posb.miny;
+        if (posb.minx < cull.minx)
+        {
+            pos.minx = cull.minx;
+            uv0.minx = uv0b.minx + (uv0b.maxx - uv0b.minx) * (cull.minx - posb.minx) / width;
+        }
+        if (posb.maxx > cull.maxx)
+        {
+            pos.maxx = cull.maxx;
+            uv0.maxx = uv0b.maxx - (uv0b.maxx - uv0b.minx) * (posb.maxx - cull.maxx) / width;
+        }
+        if (posb.miny < cull.miny)
+        {
+            pos.miny = cull.miny;
+            uv0.miny = uv0b.miny + (uv0b.maxy - uv0b.miny) * (cull.miny - posb.miny) / height;
+        }
+        if (posb.maxy > cull.maxy)
+        {
+            pos.maxy = cull.maxy;
+            uv0.maxy = uv0b.maxy - (uv0b.maxy - uv0b.miny) * (posb.maxy - cull.maxy) / height;
+        }
+    }
 
-    const float exp_x = 1.0f;
-    const float exp_y = 1.0f;
-    const Bounds expb{posb.minx - exp_x, posb.miny - exp_y, posb.maxx + exp_x, posb.maxy + exp_y};
+    if (m_rectStateId == INVALID_STATE_ID)
+        m_rectStateId = internCallState(m_callState, nullptr);
+    switchToCall(DRAW_RECT, m_rectStateId);
+    if (m_currentCall->count == 0)
+        m_currentCall->first = static_cast<GLint>(m_rects.size());
 
-    const size_t base = m_verts.size();
-    m_verts.insert(m_verts.end(),
-                   {{Point{posb.minx, posb.miny}, Point{uv0b.minx, uv0b.miny}, Point{0.0f, 0.0f}},
-                    {Point{posb.minx, posb.maxy}, Point{uv0b.minx, uv0b.maxy}, Point{0.0f, 0.0f}},
-                    {Point{posb.maxx, posb.maxy}, Point{uv0b.maxx, uv0b.maxy}, Point{0.0f, 0.0f}},
-                    {Point{posb.maxx, posb.miny}, Point{uv0b.maxx, uv0b.miny}, Point{0.0f, 0.0f}},
-                    {Point{expb.minx, posb.miny}, Point{uv0b.minx, uv0b.miny}, Point{1.0f, 0.0f}},
-                    {Point{expb.minx, posb.maxy}, Point{uv0b.minx, uv0b.maxy}, Point{1.0f, 0.0f}},
-                    {Point{posb.minx, expb.maxy}, Point{uv0b.minx, uv0b.maxy}, Point{0.0f, 1.0f}},
-                    {Point{posb.maxx, expb.maxy}, Point{uv0b.maxx, uv0b.maxy}, Point{0.0f, 1.0f}},
-                    {Point{expb.maxx, posb.maxy}, Point{uv0b.maxx, uv0b.maxy}, Point{1.0f, 0.0f}},
-                    {Point{expb.maxx, posb.miny}, Point{uv0b.maxx, uv0b.miny}, Point{1.0f, 0.0f}},
-                    {Point{posb.maxx, expb.miny}, Point{uv0b.maxx, uv0b.miny}, Point{0.0f, 1.0f}},
-                    {Point{posb.minx, expb.miny}, Point{uv0b.minx, uv0b.miny}, Point{0.0f, 1.0f}}});
-    m_indices.insert(m_indices.end(), {base + 0, base + 1, base + 2, base + 0, base + 2, base + 3,
-                                       base + 0, base + 4, base + 5, base + 0, base + 5, base + 1,
-                                       base + 1, base + 6, base + 7, base + 1, base + 7, base + 2,
-                                       base + 2, base + 8, base + 9, base + 2, base + 9, base + 3,
-                                       base + 3, base + 10, base + 11, base + 3, base + 11, base + 0,
-                                       base + 4, base + 0, base + 11, base + 6, base + 1, base + 5,
-                                       base + 8, base + 2, base + 7, base + 10, base + 3, base + 9});
-    m_currentCall->indiceCount += 42;
-}
-
-void GraphicsRecorder::buildFontBounds(const Bounds &posb, const Bounds &uv0b, const Bounds &uv1b)
-{
-    switchToNewDrawTypeCall(DRAW_FONT, m_currentCall->param.fontTexture != m_drawState.fontAtlas->getTexture());
-    m_currentCall->param.fontTexture = m_drawState.fontAtlas->getTexture();
-
-    const size_t base = m_verts.size();
+    // The vertex shader expands every instance into the 12-vertex/42-index
+    // antialiased rect (see RECT_VERTICES and RECT_INDICES).
+    m_rects.push_back(RectInstance{Point{pos.minx, pos.miny}, Point{pos.maxx, pos.maxy},
+                                   Point{uv0.minx, uv0.miny}, Point{uv0.maxx, uv0.maxy}});
+    m_currentCall->count += 1;
+    m_generation += 1;
+}
+
+void GraphicsRecorder::buildFontBounds(const Bounds &posb, const Bounds &uv0b, const Bounds &uv1b, float page,
+                                       const std::shared_ptr<Texture> &fontTexture, DrawType drawType)
+{
+    const Bounds cull = cullBounds();
+    if (posb.maxx <= cull.minx || posb.minx >= cull.maxx ||
+        posb.maxy <= cull.miny || posb.miny >= cull.maxy)
+        return;
+
+    beginFontCall(fontTexture, drawType);
     m_verts.insert(m_verts.end(),
-                   {{Point{posb.minx, posb.miny}, Point{uv0b.minx, uv0b.miny}, Point{uv1b.minx, uv1b.miny}},
-                    {Point{posb.minx, posb.maxy}, Point{uv0b.minx, uv0b.maxy}, Point{uv1b.minx, uv1b.maxy}},
-                    {Point{posb.maxx, posb.maxy}, Point{uv0b.maxx, uv0b.maxy}, Point{uv1b.maxx, uv1b.maxy}},
-                    {Point{posb.maxx, posb.miny}, Point{uv0b.maxx, uv0b.miny}, Point{uv1b.maxx, uv1b.miny}}});
-    m_indices.insert(m_indices.end(), {base + 0, base + 1, base + 2, base + 0, base + 2, base + 3});
-    m_currentCall->indiceCount += 6;
+                   {{Point{posb.minx, posb.miny}, Point{uv0b.minx, uv0b.miny}, Point{uv1b.minx, uv1b.miny}, page},
+                    {Point{posb.minx, posb.maxy}, Point{uv0b.minx, uv0b.maxy}, Point{uv1b.minx, uv1b.maxy}, page},
+                    {Point{posb.maxx, posb.maxy}, Point{uv0b.maxx, uv0b.maxy}, Point{uv1b.maxx, uv1b.maxy}, page},
+                    {Point{posb.maxx, posb.miny}, Point{uv0b.maxx, uv0b.miny}, Point{uv1b.maxx, uv1b.miny}, page}});
+    m_currentCall->count += 1;
+    m_generation += 1;
 }
 
-void GraphicsRecorder::syncFontTexture() const
+void GraphicsRecorder::beginFontCall(const std::shared_ptr<Texture> &fontTexture, DrawType drawType)
 {
-    if (m_drawState.fontAtlas != nullptr)
-        m_drawState.fontAtlas->syncTexture();
+    if (m_fontStateId == INVALID_STATE_ID || m_fontStateTexture != fontTexture.get())
+    {
+        m_fontStateId = internCallState(m_callState, fontTexture);
+        m_fontStateTexture = fontTexture.get();
+    }
+    switchToCall(drawType, m_fontStateId);
+    if (m_currentCall->count == 0)
+        m_currentCall->first = static_cast<GLint>(m_verts.size());
+}
+
+Bounds GraphicsRecorder::cullBounds() const
+{
+    const Bounds &scissor = m_callState.scissor;
+    return Bounds{std::max(m_viewport.minx, scissor.minx) - CULL_MARGIN,
+                  std::max(m_viewport.miny, scissor.miny) - CULL_MARGIN,
+                  std::min(m_viewport.maxx, scissor.maxx) + CULL_MARGIN,
+                  std::min(m_viewport.maxy, scissor.maxy) + CULL_MARGIN};
+}
+
+Bounds GraphicsRecorder::primitiveBounds(const Call &call, GLsizei i) const
+{
+    switch (call.drawType)
+    {
+    case DRAW_RECT:
+    {
+        // Inverted rects are kept as drawn, the bounds are not
+        const RectInstance &rect = m_rects[call.first + i];
+        const Bounds b{rect.posMin, rect.posMax};
+        return Bounds{b.minx - RECT_FRINGE, b.miny - RECT_FRINGE, b.maxx + RECT_FRINGE, b.maxy + RECT_FRINGE};
+    }
+    case DRAW_FONT:
+    case DRAW_FONT_SDF:
+    {
+        const Vertex *quad = &m_verts[call.first + i * 4];
+        return Bounds{quad[0].pos, quad[2].pos};
+    }
+    case DRAW_PICTURE:
+    {
+        const PictureInstance &picture = m_pictures[call.first + i];
+        const Bounds &b = picture.buffer->getBounds();
+        return Bounds{Point{b.minx * picture.scale + picture.dx, b.miny * picture.scale + picture.dy},
+                      Point{b.maxx * picture.scale + picture.dx, b.maxy * picture.scale + picture.dy}};
+    }
+    default:
+        return Bounds{};
+    }
+}
+
+Bounds GraphicsRecorder::bounds() const
+{
+    Bounds total;
+    for (const Call &call : m_calls)
+        for (GLsizei i = 0; i < call.count; ++i)
+            total = total + primitiveBounds(call, i);
+    return total;
+}
+
+void GraphicsRecorder::compactFontShelves()
+{
+    // Every drawText adds its shelves, duplicates are dropped whenever the list
+    // doubled, so it stays in the order of the distinct shelves drawn from
+    if (m_fontShelves.size() < 2 * m_uniqueFontShelves + FONT_SHELVES_SLACK)
+        return;
+    std::sort(m_fontShelves.begin(), m_fontShelves.end());
+    m_fontShelves.erase(std::unique(m_fontShelves.begin(), m_fontShelves.end()), m_fontShelves.end());
+    m_uniqueFontShelves = m_fontShelves.size();
+}
+
+void GraphicsRecorder::syncFontTextures() const
+{
+    for (const std::pair<const FontAtlas *, int> &shelf : m_fontShelves)
+        shelf.first->touchShelf(shelf.second);
+    for (const std::shared_ptr<FontAtlas> &atlas : m_fontAtlases)
+        atlas->syncTexture();
 }
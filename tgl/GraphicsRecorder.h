@@ -6,6 +6,10 @@
 #include "Font.h"
 
 #include "GraphicsStructs.h"
+#include "GraphicsPicture.h"
+#include "TextRunCache.h"
+#include <atomic>
+#include <string_view>
 
 //
 // GraphicsRecorder
@@ -16,6 +20,8 @@ public:
     GraphicsRecorder();
     ~GraphicsRecorder() = default;
 
+    // Like the destructor, safe on any thread: the font textures it drops are
+    // deleted on the GL thread ( FontAtlas::releaseTextures ).
     void clear();
 
     void save();
@@ -48,13 +54,23 @@ public:
     void setScissor(float x, float y, float width, float height);
     void unsetScissor();
 
+    // Area that reaches the screen, usually the renderer resolution. Primitives
+    // outside it and the scissor are dropped while recording, rects are trimmed.
+    void setViewport(float x, float y, float width, float height);
+    void unsetViewport();
+
     void drawRect(float x, float y, float width, float height);
     void drawImage(float dx, float dy, float scale = 1.0f);
 
     void setFontFamily(const Font &font);
     void setFontPixelSize(size_t pixelSize);
-    void drawText(float x, float y, const std::string &utf8string);
-    void drawText(float x, float y, const std::wstring &utf16string);
+    // Text is decoded in place without allocating, malformed UTF-8 draws U+FFFD
+    void drawText(float x, float y, std::string_view utf8string);
+#ifdef __cpp_char8_t
+    void drawText(float x, float y, std::u8string_view utf8string);
+#endif
+    void drawText(float x, float y, std::wstring_view utf16string);
+    void drawText(float x, float y, std::u32string_view utf32string);
 
     struct TextMetrics
     {
@@ -62,18 +78,54 @@ public:
         float ascent;
         float descent;
     };
-    TextMetrics measureText(const std::string &utf8string);
-    TextMetrics measureText(const std::wstring &utf16string);
+    TextMetrics measureText(std::string_view utf8string);
+#ifdef __cpp_char8_t
+    TextMetrics measureText(std::u8string_view utf8string);
+#endif
+    TextMetrics measureText(std::wstring_view utf16string);
+    TextMetrics measureText(std::u32string_view utf32string);
+
+    // Strings drawn again with the same font and size reuse their laid out
+    // glyphs, measureText() of them is a lookup. 0 disables the cache.
+    void setTextRunCacheCapacity(size_t runs);
+
+    enum TextEncoding : uint32_t
+    {
+        ENCODING_UTF8,
+        ENCODING_WCHAR,
+        ENCODING_UTF32,
+    };
+
+    // Draws a picture with its own fills and composite operations, local
+    // coordinates mapped by pos * scale + (dx, dy). Global alpha and scissor
+    // of this recorder apply on top.
+    void drawPicture(const GraphicsPicture &picture, float dx, float dy, float scale = 1.0f);
 
     inline bool isEmpty() const
     {
-        return m_currentCall->indiceCount == 0 && m_calls.size() == 1;
+        return m_currentCall->count == 0 && m_calls.size() == 1;
     }
 
+    // Appends everything recorded by other after this recorder's calls. Recorders
+    // are independent and fonts may be shared, so panels can be recorded on worker
+    // threads ( one recorder per thread ) and merged here before commit. other
+    // must be another recorder.
+    void append(const GraphicsRecorder &other);
+
+    // Optional pass between recording and commit. Moves each primitive into the
+    // latest earlier call with the same state when no primitive drawn in between
+    // overlaps it, so the painter's order result is unchanged with fewer calls.
+    void batch();
+
 private:
-    // Vertices & Indices
+    // Rect Instances
+    std::vector<RectInstance> m_rects;
+
+    // Glyph Quads ( 4 vertices each, indexed by the renderer's shared quad indices )
     std::vector<Vertex> m_verts;
-    std::vector<GLuint> m_indices;
+
+    // Picture Instances
+    std::vector<PictureInstance> m_pictures;
 
     // Draw State
     struct DrawState
@@ -84,6 +136,28 @@ private:
     };
     DrawState m_drawState;
 
+    // Call State
+    CallState m_callState;
+    uint32_t m_rectStateId = INVALID_STATE_ID; // Also used by pictures
+    uint32_t m_fontStateId = INVALID_STATE_ID;
+    const Texture *m_fontStateTexture = nullptr;
+    inline void changeCallState()
+    {
+        m_rectStateId = INVALID_STATE_ID;
+        m_fontStateId = INVALID_STATE_ID;
+    }
+
+    // Interned States ( each unique state is stored once per frame, calls refer to it by id )
+    static constexpr uint32_t INVALID_STATE_ID = ~0u;
+    std::vector<CallState> m_states;
+    std::vector<uint32_t> m_stateSlots;
+    uint32_t internCallState(const CallState &callState, const std::shared_ptr<Texture> &fontTexture);
+
+    // Culling ( viewport and scissor, grown by a margin that keeps rect fringes
+    // and the shader's scissor falloff as they were )
+    Bounds m_viewport;
+    Bounds cullBounds() const;
+
     // State Stack
     struct State
     {
@@ -95,14 +169,57 @@ private:
     // Calls
     std::vector<Call> m_calls;
     Call *m_currentCall = nullptr;
-    void switchToNewActiveCall();
-    void switchToNewDrawTypeCall(DrawType drawType, bool extraCheck = false);
+    void switchToCall(DrawType drawType, uint32_t stateId);
 
     void buildRectBounds(const Bounds &posb, const Bounds &uv0b);
-    void buildFontBounds(const Bounds &posb, const Bounds &uv0b, const Bounds &uv1b);
-
-    void syncFontTexture() const;
-
+    // drawType is DRAW_FONT or DRAW_FONT_SDF, after the atlas mode
+    void buildFontBounds(const Bounds &posb, const Bounds &uv0b, const Bounds &uv1b, float page,
+                         const std::shared_ptr<Texture> &fontTexture, DrawType drawType);
+    void beginFontCall(const std::shared_ptr<Texture> &fontTexture, DrawType drawType);
+
+    // Text shared by all encodings, bytes of the string as given
+    TextRunCache m_textRuns;
+    std::vector<TextRunCache::Glyph> m_runGlyphs;
+    std::vector<int> m_runShelves;
+    std::vector<uint32_t> m_missingGlyphs;
+    void drawEncodedText(float x, float y, TextEncoding encoding, std::string_view bytes);
+    void emitTextRun(const TextRunCache::Run &run, float x, float y, const std::shared_ptr<Texture> &fontTexture,
+                     DrawType drawType);
+    TextMetrics measureEncodedText(TextEncoding encoding, std::string_view bytes);
+
+    // Area covered by a primitive of a call, and by everything recorded
+    Bounds primitiveBounds(const Call &call, GLsizei i) const;
+    Bounds bounds() const;
+
+    // Identity for the renderer's per-recorder buffers, copies get a new id
+    struct RecorderId
+    {
+        static std::atomic<uint64_t> s_next;
+        uint64_t value = s_next.fetch_add(1, std::memory_order_relaxed);
+        RecorderId() = default;
+        RecorderId(const RecorderId &) {}
+        RecorderId &operator=(const RecorderId &)
+        {
+            value = s_next.fetch_add(1, std::memory_order_relaxed);
+            return *this;
+        }
+    };
+    RecorderId m_id;
+    // Bumped whenever recorded content changes
+    uint64_t m_generation = 0;
+
+    // Fonts used since the last clear(), their textures are uploaded on commit
+    std::vector<std::shared_ptr<FontAtlas>> m_fontAtlases;
+    // LRU shelves drawn from since the last clear(), touched on commit so content
+    // committed again without re-recording keeps its glyphs
+    std::vector<std::pair<const FontAtlas *, int>> m_fontShelves;
+    size_t m_uniqueFontShelves = 0; // Size after the last compaction
+    static constexpr size_t FONT_SHELVES_SLACK = 64;
+    void compactFontShelves();
+    void syncFontTextures() const;
+
+    friend class GraphicsBuffer;
+    friend class GraphicsPicture;
     friend class GraphicsRenderer;
 };
 
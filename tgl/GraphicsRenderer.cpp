@@ -1,33 +1,91 @@
 #include "GraphicsRenderer.h"
 #include "GraphicsRecorder.h"
+#include "FontAtlas.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
 #include <cstdio>
 
+// Vertices generated per rect instance, must match RECT_INDICES in the vertex shader
+static constexpr GLsizei RECT_VERTEX_COUNT = 42;
+
+// Glyph quad topology, shared by every quad through m_quadIbo
+static constexpr size_t QUAD_VERTEX_COUNT = 4;
+static constexpr size_t QUAD_INDEX_COUNT = 6;
+// Quads addressable by 16-bit indices, larger calls are drawn in segments
+static constexpr size_t QUAD_SEGMENT_MAX = 65536 / QUAD_VERTEX_COUNT;
+
 static constexpr const char *default_header =
 #ifdef SHADER_GL_ES
-    "#version 300 es\nprecision highp float;\0";
+    "#version 300 es\nprecision highp float;\nprecision highp sampler2DArray;\0";
 #else
     "#version 330 core\0";
 #endif
 
+// Attribute locations match VertexAttrib in GraphicsStructs.h
 static constexpr const char *default_vshader = R"(
-in vec2 a_pos;
-in vec2 a_uv0;
-in vec2 a_uv1;
+layout(location = 0) in vec2 a_pos;
+layout(location = 1) in vec2 a_uv0;
+layout(location = 2) in vec2 a_uv1;
+
+// Rect Instances
+layout(location = 3) in vec4 a_rectPos;
+layout(location = 4) in vec4 a_rectUV0;
+
+layout(location = 5) in float a_page;
 
 out vec2 v_pos;
 out vec2 v_uv0;
 out vec2 v_uv1;
+out float v_page;
 
 /* Uniforms */
 uniform vec2 u_resolution;
+uniform uvec2 u_fragmentType;
+uniform vec4 u_transform; // (dx, dy, scale, scale), local to screen
+
+/* Rect Expansion */
+#define RECT_FRINGE 1.0
+
+// (corner.x, corner.y, fringe.x, fringe.y)
+const ivec4 RECT_VERTICES[12] = ivec4[12](
+    ivec4(0, 0, 0, 0), ivec4(0, 1, 0, 0), ivec4(1, 1, 0, 0), ivec4(1, 0, 0, 0),
+    ivec4(0, 0, -1, 0), ivec4(0, 1, -1, 0), ivec4(0, 1, 0, 1), ivec4(1, 1, 0, 1),
+    ivec4(1, 1, 1, 0), ivec4(1, 0, 1, 0), ivec4(1, 0, 0, -1), ivec4(0, 0, 0, -1)
+);
+
+const int RECT_INDICES[42] = int[42](
+    0, 1, 2, 0, 2, 3,
+    0, 4, 5, 0, 5, 1,
+    1, 6, 7, 1, 7, 2,
+    2, 8, 9, 2, 9, 3,
+    3, 10, 11, 3, 11, 0,
+    4, 0, 11, 6, 1, 5,
+    8, 2, 7, 10, 3, 9
+);
 
 /* VertShaders */
 void main()
 {
-    v_pos = a_pos;
-    v_uv0 = a_uv0;
-    v_uv1 = a_uv1;
-    gl_Position = vec4(2.0 * v_pos.x / u_resolution.x - 1.0, 1.0 - 2.0 * v_pos.y / u_resolution.y, 0.0, 1.0);
+    if (u_fragmentType.y == 0u) // Rect
+    {
+        ivec4 vert = RECT_VERTICES[RECT_INDICES[gl_VertexID]];
+        vec2 corner = vec2(vert.xy);
+        vec2 fringe = vec2(vert.zw);
+        v_pos = mix(a_rectPos.xy, a_rectPos.zw, corner) + fringe * RECT_FRINGE;
+        v_uv0 = mix(a_rectUV0.xy, a_rectUV0.zw, corner);
+        v_uv1 = abs(fringe);
+        v_page = 0.0;
+    }
+    else
+    {
+        v_pos = a_pos;
+        v_uv0 = a_uv0;
+        v_uv1 = a_uv1;
+        v_page = a_page;
+    }
+    vec2 pos = v_pos * u_transform.zw + u_transform.xy;
+    gl_Position = vec4(2.0 * pos.x / u_resolution.x - 1.0, 1.0 - 2.0 * pos.y / u_resolution.y, 0.0, 1.0);
 }
 )";
 
@@ -35,6 +93,7 @@ static constexpr const char *default_fshader = R"(
 in vec2 v_pos;
 in vec2 v_uv0;
 in vec2 v_uv1;
+in float v_page;
 
 /* Uniforms */
 uniform vec2 u_resolution;
@@ -52,7 +111,7 @@ uniform vec3 u_gradientParam1;
 
 /* Samplers */
 uniform sampler2D u_texture;
-uniform sampler2D u_fontAtlas;
+uniform sampler2DArray u_fontAtlas;
 
 /* FragShaders */
 #define LAYOUT_RGB888 0u
@@ -122,6 +181,7 @@ vec4 conicGradientColor(vec2 pos)
     return texture(u_texture, vec2(angle / radians(360.0), 0.0));
 }
 
+#ifdef ANALYTIC_SCISSOR
 float scissor(vec2 pmin, vec2 pmax) {
     vec2 dist = vec2(
         min(v_pos.x - pmin.x, pmax.x - v_pos.x),
@@ -131,13 +191,16 @@ float scissor(vec2 pmin, vec2 pmax) {
     float w = fwidth(d);
     return 1.0 - smoothstep(-w, w, -d);
 }
+#endif
 
 void main()
 {
+#ifdef ANALYTIC_SCISSOR
     float scissorMask = scissor(u_scissor.xy, u_scissor.zw);
     if (scissorMask < 0.05)
         discard;
-    
+#endif
+
     float geometryMask = 1.0;
     switch(u_fragmentType.y)
     {
@@ -145,9 +208,16 @@ void main()
         geometryMask *= 1.0 - length(v_uv1);
         break;
     case 1u: // Font
-        geometryMask *= texture(u_fontAtlas, v_uv1).r;
+        geometryMask *= texture(u_fontAtlas, vec3(v_uv1, v_page)).r;
+        break;
+    case 3u: // SDF Font ( edge at 0.5, antialiased over one screen pixel )
+    {
+        float dist = texture(u_fontAtlas, vec3(v_uv1, v_page)).r;
+        float pixel = max(length(vec2(dFdx(dist), dFdy(dist))), 1e-4);
+        geometryMask *= clamp((dist - 0.5) / pixel + 0.5, 0.0, 1.0);
         break;
     }
+    }
     if (geometryMask < 0.05)
         discard;
 
@@ -176,8 +246,10 @@ void main()
     // Drawing
     resultColor *= geometryMask;
 
+#ifdef ANALYTIC_SCISSOR
     // Scissoring
     resultColor *= scissorMask;
+#endif
 
     // Alpha Blending
     resultColor *= u_alpha;
@@ -189,41 +261,39 @@ void main()
 
 GraphicsRenderer::GraphicsRenderer()
 {
-    // Initialize shader
-    m_shader.compile(default_header, default_vshader, default_fshader);
-    if (m_shader.isValid() == 0)
+    // Initialize shaders
+    static constexpr const char *variant_defines[VARIANT_COUNT] = {"", "#define ANALYTIC_SCISSOR\n"};
+    for (size_t variant = 0; variant < VARIANT_COUNT; ++variant)
     {
-        std::printf("Shader compilation failed\n");
-    }
+        Shader &shader = m_shaders[variant];
+        ShaderLocs &locs = m_locs[variant];
+        shader.compile(default_header, default_vshader, default_fshader, variant_defines[variant]);
+        if (shader.isValid() == 0)
+        {
+            std::printf("Shader compilation failed\n");
+        }
 
-#define GET_ATTRIB_LOC(name) m_locs.name = m_shader.getAttribLocation(#name)
-    // Get Attribs Locations
-    GET_ATTRIB_LOC(a_pos);
-    GET_ATTRIB_LOC(a_uv0);
-    GET_ATTRIB_LOC(a_uv1);
-#undef GET_ATTRIB_LOC
-
-#define GET_UNIFORM_LOC(name) m_locs.name = m_shader.getUniformLocation(#name)
-    // Get Uniforms Locations
-    GET_UNIFORM_LOC(u_resolution);
-    GET_UNIFORM_LOC(u_fragmentType);
-    GET_UNIFORM_LOC(u_alpha);
-    GET_UNIFORM_LOC(u_scissor);
-    GET_UNIFORM_LOC(u_color);
-    GET_UNIFORM_LOC(u_imageParams);
-    GET_UNIFORM_LOC(u_gradientParam0);
-    GET_UNIFORM_LOC(u_gradientParam1);
-    // Get Samplers Locations
-    GET_UNIFORM_LOC(u_texture);
-    GET_UNIFORM_LOC(u_fontAtlas);
+#define GET_UNIFORM_LOC(name) locs.name = shader.getUniformLocation(#name)
+        // Get Uniforms Locations
+        GET_UNIFORM_LOC(u_resolution);
+        GET_UNIFORM_LOC(u_transform);
+        GET_UNIFORM_LOC(u_fragmentType);
+        GET_UNIFORM_LOC(u_alpha);
+        GET_UNIFORM_LOC(u_scissor);
+        GET_UNIFORM_LOC(u_color);
+        GET_UNIFORM_LOC(u_imageParams);
+        GET_UNIFORM_LOC(u_gradientParam0);
+        GET_UNIFORM_LOC(u_gradientParam1);
+        // Get Samplers Locations
+        GET_UNIFORM_LOC(u_texture);
+        GET_UNIFORM_LOC(u_fontAtlas);
 #undef GET_UNIFORM_LOC
+    }
+    m_variant = VARIANT_COUNT;
 
     // Initialize buffer
-    glGenBuffers(1, &m_vbo);
-    m_vboSize = 0;
-    glGenBuffers(1, &m_ibo);
-    m_iboSize = 0;
-    glGenVertexArrays(1, &m_vao);
+    glGenBuffers(1, &m_quadIbo);
+    m_quadIboCapacity = 0;
 
     // Initialize blend ( Alpha blend, PREMULTIPLIED Shader )
     glEnable(GL_BLEND);
@@ -242,110 +312,278 @@ GraphicsRenderer::GraphicsRenderer()
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, 0);
     glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
 }
 
 GraphicsRenderer::~GraphicsRenderer()
 {
-    glDeleteBuffers(1, &m_vbo);
-    glDeleteBuffers(1, &m_ibo);
-    glDeleteVertexArrays(1, &m_vao);
+    glDeleteBuffers(1, &m_quadIbo);
 }
 
 void GraphicsRenderer::commit(const GraphicsRecorder &recorder)
 {
-    // Upload font
-    recorder.syncFontTexture();
-
-    // Upload vertices
-    const std::vector<Vertex> &verts = recorder.m_verts;
-    const std::vector<GLuint> &indices = recorder.m_indices;
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
-    size_t currentVboSize = verts.size() * sizeof(Vertex);
-    size_t currentIboSize = indices.size() * sizeof(GLuint);
-    if (currentVboSize > m_vboSize || currentVboSize < m_vboSize / 4)
+    const GraphicsRecorder *recorders[] = {&recorder};
+    commit(recorders, 1);
+}
+
+void GraphicsRenderer::commit(const std::vector<const GraphicsRecorder *> &recorders)
+{
+    commit(recorders.data(), recorders.size());
+}
+
+void GraphicsRenderer::commit(GraphicsRecorder &&recorder)
+{
+    const GraphicsRecorder *recorders[] = {&recorder};
+    claimSegments(recorders, 1);
+    Segment &segment = m_nextSegments.front();
+    segment.generation = recorder.m_generation;
+    segment.buffer->upload(std::move(recorder));
+    m_segments.swap(m_nextSegments);
+}
+
+void GraphicsRenderer::commit(const GraphicsRecorder *const *recorders, size_t count)
+{
+    claimSegments(recorders, count);
+    for (size_t i = 0; i < count; ++i)
     {
-        glBufferData(GL_ARRAY_BUFFER, currentVboSize, verts.data(), GL_DYNAMIC_DRAW);
-        m_vboSize = currentVboSize;
-
-        // Set VAO
-        glBindVertexArray(m_vao);
-        glVertexAttribPointer(m_locs.a_pos, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              (void *)(offsetof(Vertex, pos)));
-        glVertexAttribPointer(m_locs.a_uv0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              (void *)(offsetof(Vertex, uv0)));
-        glVertexAttribPointer(m_locs.a_uv1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                              (void *)(offsetof(Vertex, uv1)));
-        glEnableVertexAttribArray(m_locs.a_pos);
-        glEnableVertexAttribArray(m_locs.a_uv0);
-        glEnableVertexAttribArray(m_locs.a_uv1);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+        const GraphicsRecorder &recorder = *recorders[i];
+        Segment &segment = m_nextSegments[i];
+        if (segment.generation == recorder.m_generation)
+        {
+            // Unchanged, fonts may still have pages to upload
+            recorder.syncFontTextures();
+            continue;
+        }
+        segment.buffer->upload(recorder);
+        segment.generation = recorder.m_generation;
     }
-    else
+    m_segments.swap(m_nextSegments);
+}
+
+void GraphicsRenderer::claimSegments(const GraphicsRecorder *const *recorders, size_t count)
+{
+    // Take over the buffers of recorders committed last frame
+    m_nextSegments.clear();
+    for (size_t i = 0; i < count; ++i)
+    {
+        Segment &segment = m_nextSegments.emplace_back(Segment{recorders[i]->m_id.value, NEW_SEGMENT, nullptr});
+        for (Segment &previous : m_segments)
+            if (previous.buffer != nullptr && previous.recorderId == segment.recorderId)
+            {
+                segment = std::move(previous);
+                break;
+            }
+    }
+
+    // New recorders reuse buffers left unclaimed
+    auto unclaimed = m_segments.begin();
+    for (Segment &segment : m_nextSegments)
     {
-        glBufferSubData(GL_ARRAY_BUFFER, 0, currentVboSize, verts.data());
+        if (segment.buffer != nullptr)
+            continue;
+        while (unclaimed != m_segments.end() && unclaimed->buffer == nullptr)
+            ++unclaimed;
+        if (unclaimed != m_segments.end())
+            segment.buffer = std::move((unclaimed++)->buffer);
+        else
+            segment.buffer = std::make_unique<GraphicsBuffer>();
     }
+}
 
-    // Upload indices
-    if (currentIboSize > m_iboSize || currentIboSize < m_iboSize / 4)
+void GraphicsRenderer::render()
+{
+    // Prewarmed glyphs, and font textures released on other threads since the last frame
+    FontAtlas::publishPrewarms();
+    FontAtlas::releaseTextures();
+
+    // Renderer
+    for (size_t variant = 0; variant < VARIANT_COUNT; ++variant)
     {
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, currentIboSize, indices.data(), GL_DYNAMIC_DRAW);
-        m_iboSize = currentIboSize;
+        const ShaderLocs &locs = m_locs[variant];
+        m_shaders[variant].bind();
+        glUniform2f(locs.u_resolution, static_cast<float>(m_width), static_cast<float>(m_height));
+        glUniform1i(locs.u_texture, 0);
+        glUniform1i(locs.u_fontAtlas, 1);
+        m_transformDirty[variant] = true;
+    }
+    m_variant = VARIANT_COUNT - 1;
+    m_transform[0] = 0.0f, m_transform[1] = 0.0f, m_transform[2] = 1.0f;
+    glGetIntegerv(GL_VIEWPORT, m_viewport);
+    m_pixelScale[0] = m_width > 0 ? static_cast<float>(m_viewport[2]) / static_cast<float>(m_width) : 1.0f;
+    m_pixelScale[1] = m_height > 0 ? static_cast<float>(m_viewport[3]) / static_cast<float>(m_height) : 1.0f;
+    glDisable(GL_SCISSOR_TEST);
+    m_scissorEnabled = false;
+
+    const float inf = std::numeric_limits<float>::infinity();
+    for (const Segment &segment : m_segments)
+        renderBuffer(*segment.buffer, 0.0f, 0.0f, 1.0f, Bounds{-inf, -inf, +inf, +inf}, 1.0f);
+
+    // Streamed regions may be rewritten once these draws complete
+    for (const Segment &segment : m_segments)
+        segment.buffer->fence();
+
+    // Leave scissor test off for the application's clears
+    glDisable(GL_SCISSOR_TEST);
+}
 
-        // Set VAO
-        glBindVertexArray(m_vao);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+void GraphicsRenderer::bindVariant(size_t variant)
+{
+    if (variant != m_variant)
+    {
+        m_shaders[variant].bind();
+        m_variant = variant;
     }
-    else
+    if (m_transformDirty[variant])
     {
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, currentIboSize, indices.data());
+        glUniform4f(m_locs[variant].u_transform, m_transform[0], m_transform[1], m_transform[2], m_transform[2]);
+        m_transformDirty[variant] = false;
     }
+}
 
-    // Upload calls
-    m_calls = recorder.m_calls;
-    if (m_calls.size() < m_calls.capacity() / 4)
-        m_calls.shrink_to_fit();
+void GraphicsRenderer::setTransform(float dx, float dy, float scale)
+{
+    if (m_transform[0] == dx && m_transform[1] == dy && m_transform[2] == scale)
+        return;
+    m_transform[0] = dx, m_transform[1] = dy, m_transform[2] = scale;
+    for (size_t variant = 0; variant < VARIANT_COUNT; ++variant)
+        m_transformDirty[variant] = true;
 }
 
-void GraphicsRenderer::render()
+bool GraphicsRenderer::setHardwareScissor(const Bounds &scissor)
 {
-    // Bind shader
-    m_shader.bind();
+    const float width = static_cast<float>(m_width);
+    const float height = static_cast<float>(m_height);
+    if (scissor.minx <= 0.0f && scissor.miny <= 0.0f && scissor.maxx >= width && scissor.maxy >= height)
+    {
+        if (m_scissorEnabled)
+            glDisable(GL_SCISSOR_TEST);
+        m_scissorEnabled = false;
+        return true;
+    }
 
-    // Bind VAO
-    glBindVertexArray(m_vao);
+    const Bounds box{std::max(scissor.minx, 0.0f), std::max(scissor.miny, 0.0f),
+                     std::min(scissor.maxx, width), std::min(scissor.maxy, height)};
+    if (box.maxx <= box.minx || box.maxy <= box.miny)
+        return false; // Off screen, glScissor would reject the negative size and keep its box
+    if (!m_scissorEnabled)
+        glEnable(GL_SCISSOR_TEST);
+    if (!m_scissorEnabled || box.minx != m_scissorBox.minx || box.miny != m_scissorBox.miny ||
+        box.maxx != m_scissorBox.maxx || box.maxy != m_scissorBox.maxy)
+    {
+        // Window coordinates have y up, from the viewport origin
+        const float sx = m_pixelScale[0], sy = m_pixelScale[1];
+        glScissor(m_viewport[0] + static_cast<GLint>(std::lround(box.minx * sx)),
+                  m_viewport[1] + static_cast<GLint>(std::lround((height - box.maxy) * sy)),
+                  static_cast<GLsizei>(std::lround((box.maxx - box.minx) * sx)),
+                  static_cast<GLsizei>(std::lround((box.maxy - box.miny) * sy)));
+        m_scissorBox = box;
+    }
+    m_scissorEnabled = true;
+    return true;
+}
 
-    // Renderer
-    glUniform2f(m_locs.u_resolution, static_cast<float>(m_width), static_cast<float>(m_height));
-    glUniform1i(m_locs.u_texture, 0);
-    glUniform1i(m_locs.u_fontAtlas, 1);
+void GraphicsRenderer::bindQuadIndices(size_t quadCount)
+{
+    // Element array binding is VAO state, the bound VAO gets the shared indices
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_quadIbo);
+    if (quadCount <= m_quadIboCapacity)
+        return;
+
+    // Grow shared quad indices
+    size_t capacity = std::max<size_t>(m_quadIboCapacity, 1024);
+    while (capacity < quadCount)
+        capacity *= 2;
+    std::vector<GLushort> indices(capacity * QUAD_INDEX_COUNT);
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        const GLushort base = static_cast<GLushort>(i * QUAD_VERTEX_COUNT);
+        GLushort *quad = &indices[i * QUAD_INDEX_COUNT];
+        quad[0] = base + 0, quad[1] = base + 1, quad[2] = base + 2;
+        quad[3] = base + 0, quad[4] = base + 2, quad[5] = base + 3;
+    }
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+    m_quadIboCapacity = capacity;
+}
 
-    for (const Call &call : m_calls)
+void GraphicsRenderer::renderBuffer(const GraphicsBuffer &buffer, float dx, float dy, float scale,
+                                    const Bounds &clip, float alpha)
+{
+    // Screen clip in the buffer's local coordinates
+    setTransform(dx, dy, scale);
+    const Bounds localClip{(clip.minx - dx) / scale, (clip.miny - dy) / scale,
+                           (clip.maxx - dx) / scale, (clip.maxy - dy) / scale};
+    const float inf = std::numeric_limits<float>::infinity();
+    auto isAligned = [](float v)
+    { return std::isinf(v) || v == std::floor(v); };
+
+    for (const Call &call : buffer.m_calls)
     {
-        glBlendFuncSeparate(call.state.sfactor, call.state.dfactor,
-                            call.state.sfactor, call.state.dfactor);
-        glUniform2ui(m_locs.u_fragmentType, call.state.fillType, call.param.drawType);
-        glUniform1f(m_locs.u_alpha, call.state.alpha);
-        glUniform4f(m_locs.u_scissor,
-                    call.state.scissor.minx, call.state.scissor.miny,
-                    call.state.scissor.maxx, call.state.scissor.maxy);
-        switch (call.state.fillType)
+        if (call.count == 0)
+            continue;
+        const CallState &state = buffer.m_states[call.stateId];
+
+        // Scissor in screen pixels
+        const Bounds screenScissor{std::max(clip.minx, state.scissor.minx * scale + dx),
+                                   std::max(clip.miny, state.scissor.miny * scale + dy),
+                                   std::min(clip.maxx, state.scissor.maxx * scale + dx),
+                                   std::min(clip.maxy, state.scissor.maxy * scale + dy)};
+
+        if (call.drawType == DRAW_PICTURE)
+        {
+            // drawPicturePass ( this call's scissor and alpha apply to the whole picture )
+            for (GLsizei i = 0; i < call.count; ++i)
+            {
+                const PictureInstance &picture = buffer.m_pictures[call.first + i];
+                renderBuffer(*picture.buffer,
+                             dx + picture.dx * scale, dy + picture.dy * scale, scale * picture.scale,
+                             screenScissor, alpha * state.alpha);
+            }
+            setTransform(dx, dy, scale);
+            continue;
+        }
+
+        // scissorPass
+        if (screenScissor.minx >= screenScissor.maxx || screenScissor.miny >= screenScissor.maxy)
+            continue;
+        // Aligned to window pixels, not screen ones
+        if (isAligned(screenScissor.minx * m_pixelScale[0]) && isAligned(screenScissor.miny * m_pixelScale[1]) &&
+            isAligned(screenScissor.maxx * m_pixelScale[0]) && isAligned(screenScissor.maxy * m_pixelScale[1]))
+        {
+            if (!setHardwareScissor(screenScissor))
+                continue;
+            bindVariant(VARIANT_HARDWARE_SCISSOR);
+        }
+        else
+        {
+            bindVariant(VARIANT_ANALYTIC_SCISSOR);
+            setHardwareScissor(Bounds{-inf, -inf, +inf, +inf});
+            glUniform4f(m_locs[m_variant].u_scissor,
+                        std::max(state.scissor.minx, localClip.minx), std::max(state.scissor.miny, localClip.miny),
+                        std::min(state.scissor.maxx, localClip.maxx), std::min(state.scissor.maxy, localClip.maxy));
+        }
+        const ShaderLocs &locs = m_locs[m_variant];
+
+        glBlendFuncSeparate(state.sfactor, state.dfactor,
+                            state.sfactor, state.dfactor);
+        glUniform2ui(locs.u_fragmentType, state.fillType, call.drawType);
+        glUniform1f(locs.u_alpha, alpha * state.alpha);
+        switch (state.fillType)
         {
         case FILL_COLOR:
         {
             // fillColorPass
-            glUniform4f(m_locs.u_color,
-                        call.state.color.r, call.state.color.g,
-                        call.state.color.b, call.state.color.a);
+            glUniform4f(locs.u_color,
+                        state.color.r, state.color.g,
+                        state.color.b, state.color.a);
             break;
         }
 
         case FILL_IMAGE:
         {
             // drawImagePass
-            glUniform1ui(m_locs.u_imageParams, call.state.imageParams);
+            glUniform1ui(locs.u_imageParams, state.imageParams);
             glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, call.state.texture->getTex());
+            glBindTexture(GL_TEXTURE_2D, state.texture->getTex());
             break;
         }
 
@@ -354,28 +592,53 @@ void GraphicsRenderer::render()
         case FILL_CONIC_GRADIENT:
         {
             // fillGradientPass
-            glUniform3f(m_locs.u_gradientParam0,
-                        call.state.gradientParam0[0], call.state.gradientParam0[1], call.state.gradientParam0[2]);
-            glUniform3f(m_locs.u_gradientParam1,
-                        call.state.gradientParam1[0], call.state.gradientParam1[1], call.state.gradientParam1[2]);
+            glUniform3f(locs.u_gradientParam0,
+                        state.gradientParam0[0], state.gradientParam0[1], state.gradientParam0[2]);
+            glUniform3f(locs.u_gradientParam1,
+                        state.gradientParam1[0], state.gradientParam1[1], state.gradientParam1[2]);
             glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, call.state.texture->getTex());
+            glBindTexture(GL_TEXTURE_2D, state.texture->getTex());
             break;
         }
 
         default:
             break;
         }
-        switch (call.param.drawType)
+        switch (call.drawType)
+        {
+        case DRAW_RECT:
         {
+            // drawRectPass
+            const size_t base = buffer.m_rectOffset + call.first * sizeof(RectInstance);
+            glBindVertexArray(buffer.m_rectVao);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer.m_rectVbo.getBuffer());
+            glVertexAttribPointer(ATTRIB_RECT_POS, 4, GL_FLOAT, GL_FALSE, sizeof(RectInstance),
+                                  (void *)(base + offsetof(RectInstance, posMin)));
+            glVertexAttribPointer(ATTRIB_RECT_UV0, 4, GL_FLOAT, GL_FALSE, sizeof(RectInstance),
+                                  (void *)(base + offsetof(RectInstance, uv0Min)));
+            glDrawArraysInstanced(GL_TRIANGLES, 0, RECT_VERTEX_COUNT, call.count);
+            break;
+        }
+
         case DRAW_FONT:
+        case DRAW_FONT_SDF:
+        {
+            // drawFontPass
             glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, call.param.fontTexture->getTex());
+            glBindTexture(GL_TEXTURE_2D_ARRAY, state.fontTexture->getTex());
+            glBindVertexArray(buffer.m_vao);
+            bindQuadIndices(std::min<size_t>(call.count, QUAD_SEGMENT_MAX));
+            for (GLsizei drawn = 0; drawn < call.count; drawn += QUAD_SEGMENT_MAX)
+            {
+                const GLsizei quads = std::min<GLsizei>(call.count - drawn, QUAD_SEGMENT_MAX);
+                glDrawElementsBaseVertex(GL_TRIANGLES, quads * QUAD_INDEX_COUNT, GL_UNSIGNED_SHORT, nullptr,
+                                         buffer.m_vertBase + call.first + drawn * QUAD_VERTEX_COUNT);
+            }
             break;
+        }
 
         default:
             break;
         }
-        glDrawElements(GL_TRIANGLES, call.indiceCount, GL_UNSIGNED_INT, call.indiceOffset);
     }
 }
@@ -5,8 +5,10 @@
 
 #include "Shader.h"
 #include "GraphicsStructs.h"
+#include "GraphicsBuffer.h"
 #include "OpenGLHeader.h"
 #include <vector>
+#include <memory>
 #include <cstddef>
 
 class GraphicsRecorder;
@@ -27,22 +29,31 @@ public:
     }
 
     void commit(const GraphicsRecorder &recorder);
+    // Commits recorders drawn in list order. Each keeps its own GPU buffer across
+    // frames, which is uploaded again only when the recorder changed.
+    void commit(const std::vector<const GraphicsRecorder *> &recorders);
+    // Takes the recorder's calls without copying and leaves it cleared, its
+    // storage recycled from the previous commit
+    void commit(GraphicsRecorder &&recorder);
     void render();
 
 private:
     size_t m_width;
     size_t m_height;
 
-    // Shader
-    Shader m_shader;
+    // Shaders ( integer-aligned scissors use glScissor and the variant without
+    // the analytic scissor, fractional or transformed ones the soft-edge variant )
+    enum ShaderVariant
+    {
+        VARIANT_HARDWARE_SCISSOR,
+        VARIANT_ANALYTIC_SCISSOR,
+        VARIANT_COUNT
+    };
     struct ShaderLocs
     {
-        // Attribs
-        GLint a_pos;
-        GLint a_uv0;
-        GLint a_uv1;
         // Uniforms
         GLint u_resolution;
+        GLint u_transform;
         GLint u_fragmentType;
         GLint u_alpha;
         GLint u_scissor;
@@ -54,17 +65,44 @@ private:
         GLint u_texture;
         GLint u_fontAtlas;
     };
-    ShaderLocs m_locs;
+    Shader m_shaders[VARIANT_COUNT];
+    ShaderLocs m_locs[VARIANT_COUNT];
+    size_t m_variant;
+    void bindVariant(size_t variant);
+
+    // Transform of the buffer being drawn, uploaded to each variant when bound
+    float m_transform[3];
+    bool m_transformDirty[VARIANT_COUNT];
+    void setTransform(float dx, float dy, float scale);
 
-    // VBO & IBO & VAO
-    GLuint m_vbo;
-    size_t m_vboSize;
-    GLuint m_ibo;
-    size_t m_iboSize;
-    GLuint m_vao;
+    // Hardware scissor, in screen pixels with y down. The viewport read at render()
+    // maps them to window pixels, which differ on HiDPI and for offset viewports.
+    GLint m_viewport[4];
+    float m_pixelScale[2];
+    bool m_scissorEnabled;
+    Bounds m_scissorBox;
+    // False when nothing of scissor is on screen, the draw is skipped then
+    bool setHardwareScissor(const Bounds &scissor);
 
-    // Calls
-    std::vector<Call> m_calls;
+    // Shared Quad Indices
+    GLuint m_quadIbo;         // Immutable 16-bit quad indices, only regrown when more quads are needed
+    size_t m_quadIboCapacity; // In quads, at most 65536 vertices
+    void bindQuadIndices(size_t quadCount);
+
+    // Committed Recorders
+    struct Segment
+    {
+        uint64_t recorderId;
+        uint64_t generation;
+        std::unique_ptr<GraphicsBuffer> buffer;
+    };
+    std::vector<Segment> m_segments;
+    std::vector<Segment> m_nextSegments;
+    static constexpr uint64_t NEW_SEGMENT = ~0ull; // Generation no recorder reaches
+    void commit(const GraphicsRecorder *const *recorders, size_t count);
+    void claimSegments(const GraphicsRecorder *const *recorders, size_t count);
+    void renderBuffer(const GraphicsBuffer &buffer, float dx, float dy, float scale,
+                      const Bounds &clip, float alpha);
 };
 
 #endif
@@ -11,25 +11,52 @@ struct Vertex
     Point pos;
     Point uv0;
     Point uv1;
+    float page; // Layer of the font atlas texture
 };
 
 static_assert(std::is_pod_v<Vertex> == true);
 
+//
+// RectInstance
+//
+struct RectInstance
+{
+    Point posMin;
+    Point posMax;
+    Point uv0Min;
+    Point uv0Max;
+};
+
+static_assert(std::is_pod_v<RectInstance> == true);
+
 #include "Texture.h"
 #include <memory>
+#include <functional>
+#include <algorithm>
 
 //
-// CallParam
+// VertexAttrib
 //
-enum DrawType : uint32_t
+// Fixed locations, must match the layout qualifiers in the renderer's vertex shader
+enum VertexAttrib : GLuint
 {
-    DRAW_RECT = 0u,
-    DRAW_FONT = 1u
+    ATTRIB_POS = 0u,
+    ATTRIB_UV0 = 1u,
+    ATTRIB_UV1 = 2u,
+    ATTRIB_RECT_POS = 3u,
+    ATTRIB_RECT_UV0 = 4u,
+    ATTRIB_PAGE = 5u
 };
-struct CallParam
+
+//
+// DrawType
+//
+enum DrawType : uint32_t
 {
-    DrawType drawType;
-    std::shared_ptr<Texture> fontTexture = nullptr;
+    DRAW_RECT = 0u,
+    DRAW_FONT = 1u,
+    DRAW_PICTURE = 2u,
+    DRAW_FONT_SDF = 3u // Glyph quads over a distance field atlas
 };
 
 //
@@ -55,10 +82,78 @@ struct CallState
     FillType fillType;
     Color color;
     uint32_t imageParams;
-    float gradientParam0[3];
-    float gradientParam1[3];
+    float gradientParam0[3] = {}; // Components a gradient does not use stay zero
+    float gradientParam1[3] = {};
     /* Textures */
     std::shared_ptr<Texture> texture = nullptr;
+    std::shared_ptr<Texture> fontTexture = nullptr;
+
+    // Compares the fields used by fillType, fontTexture excluded.
+    inline bool equals(const CallState &other) const
+    {
+        if (sfactor != other.sfactor || dfactor != other.dfactor || alpha != other.alpha ||
+            scissor.minx != other.scissor.minx || scissor.miny != other.scissor.miny ||
+            scissor.maxx != other.scissor.maxx || scissor.maxy != other.scissor.maxy ||
+            fillType != other.fillType)
+            return false;
+        switch (fillType)
+        {
+        case FILL_COLOR:
+            return color.r == other.color.r && color.g == other.color.g &&
+                   color.b == other.color.b && color.a == other.color.a;
+        case FILL_IMAGE:
+            return texture == other.texture && imageParams == other.imageParams;
+        case FILL_LINEAR_GRADIENT:
+        case FILL_RADIAL_GRADIENT:
+        case FILL_CONIC_GRADIENT:
+            return texture == other.texture &&
+                   std::equal(gradientParam0, gradientParam0 + 3, other.gradientParam0) &&
+                   std::equal(gradientParam1, gradientParam1 + 3, other.gradientParam1);
+        default:
+            return true;
+        }
+    }
+
+    // Hashes the fields compared by equals().
+    inline size_t hash() const
+    {
+        size_t h = std::hash<uint32_t>()(fillType);
+        auto combine = [&h](size_t v)
+        { h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2); };
+        combine(sfactor);
+        combine(dfactor);
+        combine(std::hash<float>()(alpha));
+        combine(std::hash<float>()(scissor.minx));
+        combine(std::hash<float>()(scissor.miny));
+        combine(std::hash<float>()(scissor.maxx));
+        combine(std::hash<float>()(scissor.maxy));
+        switch (fillType)
+        {
+        case FILL_COLOR:
+            combine(std::hash<float>()(color.r));
+            combine(std::hash<float>()(color.g));
+            combine(std::hash<float>()(color.b));
+            combine(std::hash<float>()(color.a));
+            break;
+        case FILL_IMAGE:
+            combine(std::hash<Texture *>()(texture.get()));
+            combine(imageParams);
+            break;
+        case FILL_LINEAR_GRADIENT:
+        case FILL_RADIAL_GRADIENT:
+        case FILL_CONIC_GRADIENT:
+            combine(std::hash<Texture *>()(texture.get()));
+            for (int i = 0; i < 3; ++i)
+            {
+                combine(std::hash<float>()(gradientParam0[i]));
+                combine(std::hash<float>()(gradientParam1[i]));
+            }
+            break;
+        default:
+            break;
+        }
+        return h;
+    }
 };
 
 //
@@ -66,10 +161,28 @@ struct CallState
 //
 struct Call
 {
-    CallParam param;
-    CallState state;
-    void *indiceOffset;
-    GLsizei indiceCount;
+    DrawType drawType;
+    /* Index into the recorder's interned CallState table */
+    uint32_t stateId;
+    /* DRAW_RECT: first rect instance, DRAW_FONT(_SDF): base vertex, DRAW_PICTURE: first picture instance */
+    GLint first;
+    /* DRAW_RECT: rect instances, DRAW_FONT(_SDF): glyph quads, DRAW_PICTURE: picture instances */
+    GLsizei count;
+};
+
+static_assert(std::is_pod_v<Call> == true);
+
+//
+// PictureInstance
+//
+class GraphicsBuffer;
+struct PictureInstance
+{
+    std::shared_ptr<const GraphicsBuffer> buffer;
+    /* Local to parent: pos * scale + (dx, dy) */
+    float dx;
+    float dy;
+    float scale;
 };
 
 #endif
@@ -0,0 +1,51 @@
+#include "MappedFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
+MappedFile::MappedFile(const char *path)
+{
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        void *address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        if (address != MAP_FAILED)
+        {
+            m_data = static_cast<const unsigned char *>(address);
+            m_size = static_cast<size_t>(info.st_size);
+            m_isMapped = true;
+        }
+    }
+    // The mapping keeps its own reference to the file
+    close(fd);
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return;
+    m_buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (!m_buffer.empty())
+    {
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+    }
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+    if (m_isMapped)
+        munmap(const_cast<unsigned char *>(m_data), m_size);
+#endif
+}
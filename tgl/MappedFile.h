@@ -0,0 +1,38 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <vector>
+
+//
+// MappedFile
+//
+// Read-only view of a whole file, mapped into memory where the platform
+// allows it and read into memory otherwise. Pages are loaded as they are
+// touched, and mappings of the same file share the page cache.
+class MappedFile
+{
+public:
+    // Invalid when the file cannot be opened or mapped, see isValid()
+    MappedFile(const char *path);
+    ~MappedFile();
+
+    // Getters
+    inline const unsigned char *data() const { return m_data; }
+    inline size_t size() const { return m_size; }
+    inline bool isValid() const { return m_data != nullptr; }
+
+    // Copying and move semantics
+    MappedFile(const MappedFile &other) = delete;
+    MappedFile &operator=(const MappedFile &other) = delete;
+    MappedFile(MappedFile &&other) = delete;
+    MappedFile &operator=(MappedFile &&other) = delete;
+
+private:
+    const unsigned char *m_data = nullptr;
+    size_t m_size = 0;
+    bool m_isMapped = false;
+    std::vector<unsigned char> m_buffer; // Unmapped fallback
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "RectanizerShelf.h"
+#include <algorithm>
+
+void RectanizerShelf::reset()
+{
+    m_top = 0;
+    m_shelves.clear();
+}
+
+int RectanizerShelf::addRect(int width, int height, int &refx, int &refy)
+{
+    if (width <= 0 || height <= 0 || width > m_width || height > m_height)
+        return -1;
+    const int rounded = (height + SHELF_ROUNDING - 1) / SHELF_ROUNDING * SHELF_ROUNDING;
+
+    // 1. Used shelf of about the same height with room left, least waste first
+    // 2. Empty shelf tall enough, or the space below all shelves
+    // 3. Any shelf with room
+    int best = -1;
+    for (int i = 0; i < shelfCount(); ++i)
+    {
+        const Shelf &shelf = m_shelves[i];
+        if (!shelf.live || shelf.used == 0 || shelf.height < height || shelf.height > rounded + rounded / 2 ||
+            m_width - shelf.used < width)
+            continue;
+        if (best < 0 || shelf.height < m_shelves[best].height)
+            best = i;
+    }
+    if (best < 0)
+    {
+        for (int i = 0; i < shelfCount(); ++i)
+        {
+            const Shelf &shelf = m_shelves[i];
+            if (!shelf.live || shelf.used != 0 || shelf.height < height)
+                continue;
+            if (best < 0 || shelf.height < m_shelves[best].height)
+                best = i;
+        }
+        if (best >= 0)
+        {
+            splitShelf(best, rounded);
+        }
+        else if (m_top + height <= m_height)
+        {
+            best = newShelfId();
+            m_shelves[best] = Shelf{m_top, std::min(rounded, m_height - m_top), 0, true};
+            m_top += m_shelves[best].height;
+        }
+    }
+    if (best < 0)
+    {
+        for (int i = 0; i < shelfCount(); ++i)
+        {
+            const Shelf &shelf = m_shelves[i];
+            if (!shelf.live || shelf.height < height || m_width - shelf.used < width)
+                continue;
+            if (best < 0 || shelf.height < m_shelves[best].height)
+                best = i;
+        }
+    }
+    if (best < 0)
+        return -1;
+
+    Shelf &shelf = m_shelves[best];
+    refx = shelf.used;
+    refy = shelf.y;
+    shelf.used += width;
+    return best;
+}
+
+void RectanizerShelf::clearShelf(int id)
+{
+    Shelf &shelf = m_shelves[id];
+    shelf.used = 0;
+
+    // Merge with empty neighbours
+    for (int i = 0; i < shelfCount(); ++i)
+    {
+        Shelf &other = m_shelves[i];
+        if (i == id || !other.live || other.used != 0)
+            continue;
+        if (other.y == shelf.y + shelf.height)
+        {
+            shelf.height += other.height;
+            other.live = false;
+            i = -1; // Rescan, the merged shelf has new neighbours
+        }
+        else if (other.y + other.height == shelf.y)
+        {
+            shelf.y = other.y;
+            shelf.height += other.height;
+            other.live = false;
+            i = -1;
+        }
+    }
+
+    // Give the last shelf back to the free space below
+    if (shelf.y + shelf.height == m_top)
+    {
+        m_top = shelf.y;
+        shelf.live = false;
+    }
+}
+
+void RectanizerShelf::splitShelf(int id, int height)
+{
+    if (m_shelves[id].height - height < SHELF_ROUNDING)
+        return;
+    const int rest = newShelfId();
+    Shelf &shelf = m_shelves[id];
+    m_shelves[rest] = Shelf{shelf.y + height, shelf.height - height, 0, true};
+    shelf.height = height;
+}
+
+int RectanizerShelf::newShelfId()
+{
+    for (int i = 0; i < shelfCount(); ++i)
+        if (!m_shelves[i].live)
+            return i;
+    m_shelves.push_back(Shelf{0, 0, 0, false});
+    return shelfCount() - 1;
+}
+
+void RectanizerShelf::save(std::vector<int32_t> &out) const
+{
+    out.push_back(m_top);
+    out.push_back(static_cast<int32_t>(m_shelves.size()));
+    for (const Shelf &shelf : m_shelves)
+        out.insert(out.end(), {shelf.y, shelf.height, shelf.used, shelf.live ? 1 : 0});
+}
+
+bool RectanizerShelf::load(const int32_t *data, size_t count)
+{
+    if (count < 2 || data[0] < 0 || data[0] > m_height || data[1] < 0 ||
+        count != 2 + 4 * static_cast<size_t>(data[1]))
+        return false;
+    for (int32_t i = 0; i < data[1]; ++i)
+    {
+        const int32_t *shelf = data + 2 + 4 * i;
+        if (shelf[3] != 0 && (shelf[0] < 0 || shelf[1] <= 0 || shelf[0] + shelf[1] > m_height ||
+                              shelf[2] < 0 || shelf[2] > m_width))
+            return false;
+    }
+
+    m_top = data[0];
+    m_shelves.clear();
+    for (int32_t i = 0; i < data[1]; ++i)
+    {
+        const int32_t *shelf = data + 2 + 4 * i;
+        m_shelves.push_back(Shelf{shelf[0], shelf[1], shelf[2], shelf[3] != 0});
+    }
+    return true;
+}
@@ -0,0 +1,66 @@
+#ifndef RECTANIZERSHELF_H
+#define RECTANIZERSHELF_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class RectanizerShelf
+{
+    /**
+     * Rects are packed left to right on horizontal shelves stacked from the
+     * top. A shelf is freed as a whole, empty neighbours merge back together
+     * so taller rects fit again. Shelf ids stay valid until the shelf is freed.
+     */
+public:
+    static constexpr int SHELF_ROUNDING = 4;
+
+    RectanizerShelf(int w, int h) : m_width(w), m_height(h)
+    {
+        reset();
+    }
+
+    ~RectanizerShelf() = default;
+
+    // Reset the layout.
+    void reset();
+
+    // Attempt to add a rect. Return the id of its shelf on success; -1 on
+    // failure. If successful the position in the atlas is returned in 'refx'
+    // and 'refy'.
+    int addRect(int w, int h, int &refx, int &refy);
+
+    // Free every rect of a shelf.
+    void clearShelf(int id);
+
+    // Append the layout as plain ints, or restore it from them. load() returns
+    // false and keeps the layout if the data does not describe one of this size.
+    void save(std::vector<int32_t> &out) const;
+    bool load(const int32_t *data, size_t count);
+
+    // Shelves, ids are below shelfCount()
+    inline int shelfCount() const { return static_cast<int>(m_shelves.size()); }
+    inline bool isShelfUsed(int id) const { return m_shelves[id].live && m_shelves[id].used > 0; }
+    inline int shelfY(int id) const { return m_shelves[id].y; }
+    inline int shelfHeight(int id) const { return m_shelves[id].height; }
+
+private:
+    const int m_width;
+    const int m_height;
+    int m_top; // Space below has no shelf yet
+
+    struct Shelf
+    {
+        int y;
+        int height;
+        int used; // Width taken from the left
+        bool live;
+    };
+    std::vector<Shelf> m_shelves;
+
+    // Takes height off the top of an empty shelf, the rest becomes a new one
+    void splitShelf(int id, int height);
+    int newShelfId();
+};
+
+#endif
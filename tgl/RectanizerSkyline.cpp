@@ -140,3 +140,33 @@ void RectanizerSkyline::addSkylineLevel(int skylineIndex, int x, int y, int widt
         }
     }
 }
+
+void RectanizerSkyline::save(std::vector<int32_t> &out) const
+{
+    out.push_back(m_areaSoFar);
+    out.push_back(static_cast<int32_t>(m_skyline.size()));
+    for (const Segment &segment : m_skyline)
+        out.insert(out.end(), {segment.x, segment.y, segment.width});
+}
+
+bool RectanizerSkyline::load(const int32_t *data, size_t count)
+{
+    if (count < 2 || data[1] <= 0 || count != 2 + 3 * static_cast<size_t>(data[1]))
+        return false;
+    int x = 0;
+    for (int32_t i = 0; i < data[1]; ++i)
+    {
+        const int32_t *segment = data + 2 + 3 * i;
+        if (segment[0] != x || segment[1] < 0 || segment[1] > m_height || segment[2] <= 0)
+            return false;
+        x += segment[2];
+    }
+    if (x != m_width)
+        return false;
+
+    m_areaSoFar = data[0];
+    m_skyline.clear();
+    for (int32_t i = 0; i < data[1]; ++i)
+        m_skyline.push_back(Segment{data[2 + 3 * i], data[3 + 3 * i], data[4 + 3 * i]});
+    return true;
+}
@@ -2,6 +2,8 @@
 #define RECTANIZERSKYLINE_H
 
 #include <vector>
+#include <cstdint>
+#include <cstddef>
 
 class RectanizerSkyline
 {
@@ -20,6 +22,11 @@ public:
     // successful the position in the atlas is returned in 'refx' and 'refy.
     bool addRect(int w, int h, int &refx, int &refy);
 
+    // Append the layout as plain ints, or restore it from them. load() returns
+    // false and keeps the layout if the data does not describe one of this size.
+    void save(std::vector<int32_t> &out) const;
+    bool load(const int32_t *data, size_t count);
+
     // Return the percentage of the atlas that is filled.
     float percentFull() const
     {
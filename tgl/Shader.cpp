@@ -32,14 +32,14 @@ Shader::~Shader()
     }
 }
 
-void Shader::compile(const char *header, const char *vshader, const char *fshader)
+void Shader::compile(const char *header, const char *vshader, const char *fshader, const char *defines)
 {
     GLint status;
-    const char *str[3] = {header, "\n", nullptr};
+    const char *str[4] = {header, "\n", defines, nullptr};
 
     GLuint vert = glCreateShader(GL_VERTEX_SHADER);
-    str[2] = vshader;
-    glShaderSource(vert, 3, str, 0);
+    str[3] = vshader;
+    glShaderSource(vert, 4, str, 0);
     glCompileShader(vert);
     glGetShaderiv(vert, GL_COMPILE_STATUS, &status);
     if (status != GL_TRUE)
@@ -49,8 +49,8 @@ void Shader::compile(const char *header, const char *vshader, const char *fshade
     }
 
     GLuint frag = glCreateShader(GL_FRAGMENT_SHADER);
-    str[2] = fshader;
-    glShaderSource(frag, 3, str, 0);
+    str[3] = fshader;
+    glShaderSource(frag, 4, str, 0);
     glCompileShader(frag);
     glGetShaderiv(frag, GL_COMPILE_STATUS, &status);
     if (status != GL_TRUE)
@@ -11,7 +11,8 @@ class Shader
 public:
     Shader() : m_prog(0) {};
     ~Shader();
-    void compile(const char *header, const char *vshader, const char *fshader);
+    // defines are inserted after the header, e.g. "#define NAME\n" for shader variants
+    void compile(const char *header, const char *vshader, const char *fshader, const char *defines = "");
     inline void bind() const { glUseProgram(m_prog); }
     inline GLint getAttribLocation(const char *attrib) const { return glGetAttribLocation(m_prog, attrib); }
     inline GLint getUniformLocation(const char *uniform) const { return glGetUniformLocation(m_prog, uniform); }
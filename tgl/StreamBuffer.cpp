@@ -0,0 +1,100 @@
+#include "StreamBuffer.h"
+#include <algorithm>
+#include <cstring>
+
+StreamBuffer::StreamBuffer(size_t stride, size_t regions)
+    : m_stride(stride), m_regions(std::clamp<size_t>(regions, 1, MAX_REGIONS)),
+      m_regionSize(0), m_region(0), m_smallWrites(0), m_smallPeak(0), m_fences{}
+{
+    glGenBuffers(1, &m_buffer);
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    for (GLsync &sync : m_fences)
+        if (sync != nullptr)
+            glDeleteSync(sync);
+    glDeleteBuffers(1, &m_buffer);
+}
+
+size_t StreamBuffer::write(const void *data, size_t size)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+    if (size == 0)
+        return m_region * m_regionSize;
+
+    if (size < m_regionSize / 4)
+    {
+        m_smallPeak = m_smallWrites == 0 ? size : std::max(m_smallPeak, size);
+        ++m_smallWrites;
+    }
+    else
+    {
+        m_smallWrites = 0;
+    }
+
+    if (size > m_regionSize || m_smallWrites >= SHRINK_WRITES)
+    {
+        // Grow, or shrink to the recent peak, with headroom; fresh storage needs no fence
+        const size_t target = std::max(size, m_smallPeak);
+        orphan(target + target / 2);
+    }
+    else
+    {
+        m_region = (m_region + 1) % m_regions;
+        GLsync &sync = m_fences[m_region];
+        if (sync != nullptr)
+        {
+            const GLenum status = glClientWaitSync(sync, 0, 0);
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+            {
+                glDeleteSync(sync);
+                sync = nullptr;
+            }
+            else
+            {
+                // GPU still reading ( or the wait failed ), let the driver hand out new storage
+                orphan(m_regionSize);
+            }
+        }
+    }
+
+    const size_t offset = m_region * m_regionSize;
+    void *dst = glMapBufferRange(GL_ARRAY_BUFFER, offset, size,
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (dst != nullptr)
+    {
+        std::memcpy(dst, data, size);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    else
+    {
+        glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+    }
+    return offset;
+}
+
+void StreamBuffer::fence()
+{
+    if (m_regionSize == 0)
+        return;
+    GLsync &sync = m_fences[m_region];
+    if (sync != nullptr)
+        glDeleteSync(sync);
+    sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void StreamBuffer::orphan(size_t regionSize)
+{
+    for (GLsync &sync : m_fences)
+        if (sync != nullptr)
+        {
+            glDeleteSync(sync);
+            sync = nullptr;
+        }
+    m_regionSize = (regionSize + m_stride - 1) / m_stride * m_stride;
+    m_region = 0;
+    m_smallWrites = 0;
+    m_smallPeak = 0;
+    glBufferData(GL_ARRAY_BUFFER, m_regionSize * m_regions, nullptr, GL_STREAM_DRAW);
+}
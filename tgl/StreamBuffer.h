@@ -0,0 +1,54 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include "OpenGLHeader.h"
+#include <cstddef>
+
+//
+// StreamBuffer
+//
+// GL_ARRAY_BUFFER split into a ring of regions. Each write() maps the next
+// region unsynchronized, so the CPU never waits on draws still reading older
+// regions. A region whose fence has not signaled yet, or data that does not
+// fit, orphans the whole buffer instead of stalling. Regions only shrink after
+// SHRINK_WRITES writes in a row used less than a quarter of them.
+class StreamBuffer
+{
+public:
+    static constexpr size_t DEFAULT_REGIONS = 3;
+
+    // Region offsets are multiples of stride
+    StreamBuffer(size_t stride, size_t regions = DEFAULT_REGIONS);
+    ~StreamBuffer();
+
+    // Copies data into the next region, returns its byte offset in the buffer
+    size_t write(const void *data, size_t size);
+    // Fences the current region after the draws reading it were issued
+    void fence();
+
+    // Getters
+    inline GLuint getBuffer() const { return m_buffer; }
+
+    // Copying and move semantics
+    StreamBuffer(const StreamBuffer &other) = delete;
+    StreamBuffer &operator=(const StreamBuffer &other) = delete;
+    StreamBuffer(StreamBuffer &&other) = delete;
+    StreamBuffer &operator=(StreamBuffer &&other) = delete;
+
+private:
+    static constexpr size_t MAX_REGIONS = 4;
+    static constexpr size_t SHRINK_WRITES = 120;
+
+    void orphan(size_t regionSize);
+
+    GLuint m_buffer;
+    size_t m_stride;
+    size_t m_regions;
+    size_t m_regionSize; // Bytes, multiple of stride
+    size_t m_region;     // Region holding the last write
+    size_t m_smallWrites; // Writes in a row under a quarter of the region
+    size_t m_smallPeak;   // Largest of them
+    GLsync m_fences[MAX_REGIONS];
+};
+
+#endif
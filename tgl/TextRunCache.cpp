@@ -0,0 +1,137 @@
+#include "TextRunCache.h"
+#include <functional>
+
+TextRunCache::TextRunCache(size_t capacity)
+{
+    setCapacity(capacity);
+}
+
+void TextRunCache::setCapacity(size_t capacity)
+{
+    m_capacity = capacity;
+    decltype(m_runs){}.swap(m_runs);
+    m_runs.reserve(capacity);
+    size_t slots = 16;
+    while (slots < capacity * 2)
+        slots *= 2;
+    m_slots.assign(capacity > 0 ? slots : 0, 0);
+    m_head = NONE;
+    m_tail = NONE;
+}
+
+TextRunCache::Run *TextRunCache::find(uint32_t encoding, std::string_view text, uint64_t atlasId, size_t pixelSize)
+{
+    if (m_runs.empty())
+        return nullptr;
+    const size_t hash = hashKey(encoding, text, atlasId, pixelSize);
+    const size_t mask = m_slots.size() - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask)
+    {
+        const uint32_t id = m_slots[slot];
+        if (id == 0)
+            return nullptr;
+        Run &run = m_runs[id - 1];
+        if (run.hash == hash && run.atlasId == atlasId && run.pixelSize == pixelSize &&
+            run.encoding == encoding && run.text == text)
+        {
+            if (m_head != id - 1)
+            {
+                unlink(id - 1);
+                link(id - 1);
+            }
+            return &run;
+        }
+    }
+}
+
+TextRunCache::Run &TextRunCache::insert(uint32_t encoding, std::string_view text, uint64_t atlasId, size_t pixelSize)
+{
+    // Take a fresh run until full, then recycle the least recently used one
+    uint32_t index;
+    if (m_runs.size() < m_capacity)
+    {
+        index = static_cast<uint32_t>(m_runs.size());
+        m_runs.emplace_back();
+    }
+    else
+    {
+        index = m_tail;
+        eraseSlot(index);
+        unlink(index);
+    }
+
+    Run &run = m_runs[index];
+    run.encoding = encoding;
+    run.text.assign(text.data(), text.size());
+    run.atlasId = atlasId;
+    run.pixelSize = pixelSize;
+    run.hash = hashKey(encoding, text, atlasId, pixelSize);
+    run.glyphs.clear();
+    link(index);
+
+    const size_t mask = m_slots.size() - 1;
+    size_t slot = run.hash & mask;
+    while (m_slots[slot] != 0)
+        slot = (slot + 1) & mask;
+    m_slots[slot] = index + 1;
+    return run;
+}
+
+size_t TextRunCache::hashKey(uint32_t encoding, std::string_view text, uint64_t atlasId, size_t pixelSize)
+{
+    size_t h = std::hash<std::string_view>()(text);
+    auto combine = [&h](size_t v)
+    { h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2); };
+    combine(encoding);
+    combine(static_cast<size_t>(atlasId));
+    combine(pixelSize);
+    return h;
+}
+
+void TextRunCache::link(uint32_t index)
+{
+    Run &run = m_runs[index];
+    run.prev = NONE;
+    run.next = m_head;
+    if (m_head != NONE)
+        m_runs[m_head].prev = index;
+    m_head = index;
+    if (m_tail == NONE)
+        m_tail = index;
+}
+
+void TextRunCache::unlink(uint32_t index)
+{
+    Run &run = m_runs[index];
+    if (run.prev != NONE)
+        m_runs[run.prev].next = run.next;
+    else
+        m_head = run.next;
+    if (run.next != NONE)
+        m_runs[run.next].prev = run.prev;
+    else
+        m_tail = run.prev;
+}
+
+void TextRunCache::eraseSlot(uint32_t index)
+{
+    // Backward shift deletion keeps probe sequences intact without tombstones
+    const size_t mask = m_slots.size() - 1;
+    size_t slot = m_runs[index].hash & mask;
+    while (m_slots[slot] != index + 1)
+        slot = (slot + 1) & mask;
+    for (size_t next = (slot + 1) & mask;; next = (next + 1) & mask)
+    {
+        const uint32_t id = m_slots[next];
+        if (id == 0)
+            break;
+        const size_t home = m_runs[id - 1].hash & mask;
+        // Move id back when its home is not cyclically within (slot, next]
+        if (((next - home) & mask) >= ((next - slot) & mask))
+        {
+            m_slots[slot] = id;
+            slot = next;
+        }
+    }
+    m_slots[slot] = 0;
+}
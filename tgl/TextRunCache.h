@@ -0,0 +1,74 @@
+#ifndef TEXTRUNCACHE_H
+#define TEXTRUNCACHE_H
+
+#include "Geometry.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+//
+// TextRunCache
+//
+// Laid out glyphs of recently drawn strings, keyed by the string's bytes and
+// encoding, font atlas and pixel size. Bounded, the least recently used run is
+// recycled with its storage, so a full cache does not allocate.
+class TextRunCache
+{
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 1024;
+
+    struct Glyph
+    {
+        Bounds posb; // Relative to the pen origin
+        Bounds uv1b;
+        float page;
+    };
+    struct Run
+    {
+        /* Key */
+        uint32_t encoding;
+        std::string text;
+        uint64_t atlasId;
+        size_t pixelSize;
+        size_t hash;
+        /* Layout, valid while the atlas generation and the epochs of its shelves are unchanged */
+        uint64_t atlasGeneration;
+        std::vector<Glyph> glyphs;
+        std::vector<int> shelves;          // Atlas shelves of the glyphs, touched on each draw
+        std::vector<uint32_t> shelfEpochs; // Of each shelf when laid out
+        Bounds bounds;
+        /* Metrics */
+        float width, ascent, descent;
+        /* LRU */
+        uint32_t prev, next;
+    };
+
+    TextRunCache(size_t capacity = DEFAULT_CAPACITY);
+    ~TextRunCache() = default;
+
+    // Drops all runs, 0 disables the cache
+    void setCapacity(size_t capacity);
+    inline size_t getCapacity() const { return m_capacity; }
+
+    // Marks the run as most recently used, nullptr on miss
+    Run *find(uint32_t encoding, std::string_view text, uint64_t atlasId, size_t pixelSize);
+    // Returns a new or recycled run with its key set, the caller fills the rest
+    Run &insert(uint32_t encoding, std::string_view text, uint64_t atlasId, size_t pixelSize);
+
+private:
+    static constexpr uint32_t NONE = ~0u;
+
+    size_t m_capacity;
+    std::vector<Run> m_runs;
+    std::vector<uint32_t> m_slots; // Open addressing, index + 1 into m_runs
+    uint32_t m_head = NONE;        // Most recently used
+    uint32_t m_tail = NONE;        // Least recently used
+
+    static size_t hashKey(uint32_t encoding, std::string_view text, uint64_t atlasId, size_t pixelSize);
+    void link(uint32_t index);
+    void unlink(uint32_t index);
+    void eraseSlot(uint32_t index);
+};
+
+#endif
@@ -1,5 +1,8 @@
 #include "Texture.h"
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
+#include <vector>
 
 #define CHECK_GL_ERROR(str)                                                           \
     {                                                                                 \
@@ -25,39 +28,53 @@
     }
 
 Texture::Texture(size_t width, size_t height, uint32_t format, uint32_t flags, const unsigned char *pixels)
-    : m_tex(0), m_format(format), m_width(width), m_height(height), m_flags(flags)
+    : m_tex(0), m_format(format), m_width(width), m_height(height), m_layers(0), m_flags(flags)
 {
+    create(pixels);
+}
+
+Texture::Texture(size_t width, size_t height, uint32_t format, uint32_t flags)
+    : m_tex(0), m_format(format), m_width(width), m_height(height), m_layers(0), m_flags(flags)
+{
+}
+
+Texture::Texture(size_t width, size_t height, size_t layers, uint32_t format, uint32_t flags)
+    : m_tex(0), m_format(format), m_width(width), m_height(height), m_layers(layers), m_flags(flags)
+{
+}
+
+void Texture::create(const unsigned char *pixels)
+{
+    const GLenum target = getTarget();
+
     // Generate texture
     glGenTextures(1, &m_tex);
 
     // Bind texture
-    glBindTexture(GL_TEXTURE_2D, m_tex);
+    glBindTexture(target, m_tex);
 
     // Setup pixel store
     PIXEL_STORE_SETUP((m_flags & FLAG_UNALIGNED) ? 1 : 4, m_width, 0, 0);
 
     // Upload texture
-    if (m_flags & FLAG_FLOAT)
-        glTexImage2D(GL_TEXTURE_2D, 0, m_format, m_width, m_height, 0, m_format, GL_FLOAT, pixels);
-    else
-        glTexImage2D(GL_TEXTURE_2D, 0, m_format, m_width, m_height, 0, m_format, GL_UNSIGNED_BYTE, pixels);
+    allocate(pixels);
 
     // Setup min filter
     if (m_flags & FLAG_MIPMAPS)
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER,
                         (m_flags & FLAG_NEAREST) ? GL_NEAREST_MIPMAP_NEAREST : GL_LINEAR_MIPMAP_LINEAR);
     else
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER,
                         (m_flags & FLAG_NEAREST) ? GL_NEAREST : GL_LINEAR);
 
     // Setup mag filter
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER,
                     (m_flags & FLAG_NEAREST) ? GL_NEAREST : GL_LINEAR);
 
     // Setup wrap mode
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+    glTexParameteri(target, GL_TEXTURE_WRAP_S,
                     (m_flags & FLAG_REPEAT_X) ? GL_REPEAT : GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+    glTexParameteri(target, GL_TEXTURE_WRAP_T,
                     (m_flags & FLAG_REPEAT_Y) ? GL_REPEAT : GL_CLAMP_TO_EDGE);
 
     // Reset pixel store
@@ -66,14 +83,23 @@ Texture::Texture(size_t width, size_t height, uint32_t format, uint32_t flags, c
     // Generate mipmaps
     if (m_flags & FLAG_MIPMAPS)
     {
-        glGenerateMipmap(GL_TEXTURE_2D);
+        glGenerateMipmap(target);
     }
 
     // Check
     CHECK_GL_ERROR("create_tex");
 
     // Unbind texture
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(target, 0);
+}
+
+void Texture::allocate(const unsigned char *pixels)
+{
+    const GLenum type = (m_flags & FLAG_FLOAT) ? GL_FLOAT : GL_UNSIGNED_BYTE;
+    if (m_layers > 0)
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, m_format, m_width, m_height, m_layers, 0, m_format, type, pixels);
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, m_format, m_width, m_height, 0, m_format, type, pixels);
 }
 
 Texture::~Texture()
@@ -87,17 +113,39 @@ Texture::~Texture()
 
 void Texture::update(size_t x, size_t y, size_t width, size_t height, const unsigned char *pixels)
 {
+    updateLayer(0, x, y, width, height, pixels);
+}
+
+void Texture::updateLayer(size_t layer, size_t x, size_t y, size_t width, size_t height, const unsigned char *pixels)
+{
+    subImage(layer, x, y, width, height, (m_flags & FLAG_UNALIGNED) ? 1 : 4, m_width, x, y, pixels);
+}
+
+void Texture::updateLayerRect(size_t layer, size_t x, size_t y, size_t width, size_t height, const unsigned char *pixels)
+{
+    subImage(layer, x, y, width, height, 1, width, 0, 0, pixels);
+}
+
+void Texture::subImage(size_t layer, size_t x, size_t y, size_t width, size_t height, GLint alignment,
+                       size_t rowLength, size_t skipX, size_t skipY, const unsigned char *pixels)
+{
+    // Create deferred texture
+    if (m_tex == 0)
+        create(nullptr);
+
     // Bind texture
-    glBindTexture(GL_TEXTURE_2D, m_tex);
+    const GLenum target = getTarget();
+    glBindTexture(target, m_tex);
 
     // Setup pixel store
-    PIXEL_STORE_SETUP((m_flags & FLAG_UNALIGNED) ? 1 : 4, m_width, x, y);
+    PIXEL_STORE_SETUP(alignment, rowLength, skipX, skipY);
 
     // Upload texture
-    if (m_flags & FLAG_FLOAT)
-        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, m_format, GL_FLOAT, pixels);
+    const GLenum type = (m_flags & FLAG_FLOAT) ? GL_FLOAT : GL_UNSIGNED_BYTE;
+    if (m_layers > 0)
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, x, y, layer, width, height, 1, m_format, type, pixels);
     else
-        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, m_format, GL_UNSIGNED_BYTE, pixels);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, m_format, type, pixels);
 
     // Reset pixel store
     PIXEL_STORE_RESET();
@@ -106,5 +154,68 @@ void Texture::update(size_t x, size_t y, size_t width, size_t height, const unsi
     CHECK_GL_ERROR("update_tex");
 
     // Unbind texture
-    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindTexture(target, 0);
+}
+
+void Texture::setLayers(size_t layers)
+{
+    if (m_layers == 0 || layers == 0 || layers == m_layers)
+        return;
+    const size_t keptLayers = std::min(layers, m_layers);
+    m_layers = layers;
+    if (m_tex == 0)
+        return;
+
+    // New storage, the kept layers are read back through a framebuffer into it
+    const GLuint oldTex = m_tex;
+    create(nullptr);
+
+    GLint readFramebuffer;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_tex);
+    for (size_t layer = 0; layer < keptLayers; ++layer)
+    {
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, oldTex, 0, layer);
+        glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, 0, 0, m_width, m_height);
+    }
+    if (m_flags & FLAG_MIPMAPS)
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &oldTex);
+    CHECK_GL_ERROR("resize_tex");
+}
+
+void Texture::readLayer(size_t layer, unsigned char *pixels) const
+{
+    const size_t channels = getChannels();
+    if (m_tex == 0)
+    {
+        std::memset(pixels, 0, m_width * m_height * channels);
+        return;
+    }
+
+    GLint readFramebuffer;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    if (m_layers > 0)
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_tex, 0, layer);
+    else
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_tex, 0);
+
+    // RGBA is the one format every implementation reads back
+    std::vector<unsigned char> rgba(m_width * m_height * 4);
+    glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+    for (size_t i = 0; i < m_width * m_height; ++i)
+        std::memcpy(pixels + i * channels, &rgba[i * 4], channels);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+    glDeleteFramebuffers(1, &fbo);
+    CHECK_GL_ERROR("read_tex");
 }
@@ -37,10 +37,23 @@ public:
         FLAG_REPEAT_Y = 1 << 4,  // Repeat image in Y direction.
         FLAG_FLOAT = 1 << 5,     // Use GL_FLOAT instead of GL_UNSIGNED_BYTE for pixel unpacking.
     };
-    Texture() : m_tex(0), m_format(FORMAT_RGBA), m_width(0), m_height(0), m_flags(0) {}
+    Texture() : m_tex(0), m_format(FORMAT_RGBA), m_width(0), m_height(0), m_layers(0), m_flags(0) {}
     Texture(size_t width, size_t height, uint32_t format, uint32_t flags, const unsigned char *pixels);
+    // Deferred: no GL call is made until the first update(), so it can be constructed off the GL thread.
+    Texture(size_t width, size_t height, uint32_t format, uint32_t flags);
+    // Deferred GL_TEXTURE_2D_ARRAY with layers of width x height.
+    Texture(size_t width, size_t height, size_t layers, uint32_t format, uint32_t flags);
     ~Texture();
     void update(size_t x, size_t y, size_t width, size_t height, const unsigned char *pixels);
+    void updateLayer(size_t layer, size_t x, size_t y, size_t width, size_t height, const unsigned char *pixels);
+    // Same, but pixels hold only the width x height rect with unaligned rows.
+    void updateLayerRect(size_t layer, size_t x, size_t y, size_t width, size_t height, const unsigned char *pixels);
+    // Reallocates an array texture with another layer count, the layers both have in
+    // common are copied on the GPU ( through a read framebuffer ), new ones are undefined.
+    void setLayers(size_t layers);
+    // Reads a layer back ( through a read framebuffer ) as width x height texels of the
+    // format with unaligned rows, zeros before the first update(). 8-bit formats only.
+    void readLayer(size_t layer, unsigned char *pixels) const;
 
     // Getters
     inline GLuint getTex() const { return m_tex; }
@@ -48,7 +61,13 @@ public:
     inline uint32_t getFlags() const { return m_flags; }
     inline int getWidth() const { return m_width; }
     inline int getHeight() const { return m_height; }
+    inline size_t getLayers() const { return m_layers; }
+    inline GLenum getTarget() const { return m_layers > 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D; }
     inline bool isValid() const { return m_tex != 0; }
+    inline size_t getChannels() const
+    {
+        return m_format == FORMAT_RED ? 1 : m_format == FORMAT_RG ? 2 : m_format == FORMAT_RGB ? 3 : 4;
+    }
 
     // Copying and move semantics
     Texture(const Texture &other) = delete;
@@ -57,10 +76,16 @@ public:
     Texture &operator=(Texture &&other) = delete;
 
 private:
+    void create(const unsigned char *pixels);
+    void allocate(const unsigned char *pixels);
+    void subImage(size_t layer, size_t x, size_t y, size_t width, size_t height, GLint alignment,
+                  size_t rowLength, size_t skipX, size_t skipY, const unsigned char *pixels);
+
     GLuint m_tex;
     GLenum m_format;
     size_t m_width;
     size_t m_height;
+    size_t m_layers; // 0 for GL_TEXTURE_2D
     uint32_t m_flags;
 };
 
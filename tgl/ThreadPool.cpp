@@ -0,0 +1,93 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <utility>
+
+ThreadPool &ThreadPool::getInstance()
+{
+    static ThreadPool instance(std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), MAX_THREADS) - 1);
+    return instance;
+}
+
+ThreadPool::ThreadPool(size_t workers)
+{
+    m_threads.reserve(workers);
+    for (size_t i = 0; i < workers; ++i)
+        m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (std::thread &thread : m_threads)
+        thread.join();
+}
+
+void ThreadPool::run(size_t count, const std::function<void(size_t, size_t)> &fn)
+{
+    if (count == 0)
+        return;
+    std::lock_guard<std::mutex> runLock(m_runMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_job = &fn;
+        m_count = count;
+        m_next.store(0, std::memory_order_relaxed);
+        m_busy = m_threads.size();
+        m_error = nullptr;
+        ++m_jobId;
+    }
+    m_wake.notify_all();
+
+    // The caller is the last thread
+    work(m_threads.size());
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this]
+                { return m_busy == 0; });
+    m_job = nullptr;
+    if (m_error)
+        std::rethrow_exception(std::exchange(m_error, nullptr));
+}
+
+void ThreadPool::workerLoop(size_t thread)
+{
+    uint64_t jobId = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_wake.wait(lock, [this, jobId]
+                    { return m_stop || m_jobId != jobId; });
+        if (m_stop)
+            return;
+        jobId = m_jobId;
+        lock.unlock();
+        work(thread);
+        lock.lock();
+        if (--m_busy == 0)
+            m_done.notify_one();
+    }
+}
+
+void ThreadPool::work(size_t thread)
+{
+    for (;;)
+    {
+        const size_t index = m_next.fetch_add(1, std::memory_order_relaxed);
+        if (index >= m_count)
+            return;
+        try
+        {
+            (*m_job)(index, thread);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_error)
+                m_error = std::current_exception();
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+//
+// ThreadPool
+//
+// Fixed workers for short data parallel jobs. The calling thread takes part in
+// each job, so a pool without workers runs it inline.
+class ThreadPool
+{
+public:
+    static constexpr size_t MAX_THREADS = 8;
+
+    // Shared pool, one thread per core up to MAX_THREADS including the caller
+    static ThreadPool &getInstance();
+
+    ThreadPool(size_t workers);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Threads taking part in a job, workers plus the caller
+    inline size_t size() const { return m_threads.size() + 1; }
+
+    // Calls fn(index, thread) for each index in [0, count) and returns when all
+    // are done. thread is in [0, size()) and unique among concurrent calls. Jobs
+    // from several threads run one after another. The first exception thrown by
+    // fn is rethrown here.
+    void run(size_t count, const std::function<void(size_t, size_t)> &fn);
+
+private:
+    std::vector<std::thread> m_threads;
+    std::mutex m_runMutex;
+
+    // Current job, guarded by m_mutex except the index counter
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const std::function<void(size_t, size_t)> *m_job = nullptr;
+    size_t m_count = 0;
+    std::atomic<size_t> m_next{0};
+    uint64_t m_jobId = 0;
+    size_t m_busy = 0;
+    std::exception_ptr m_error;
+    bool m_stop = false;
+
+    void workerLoop(size_t thread);
+    void work(size_t thread);
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+//
+// Utf8
+//
+// In-place decoding, no allocation. Malformed, overlong or surrogate sequences
+// decode to U+FFFD and resume at the next byte.
+class Utf8
+{
+public:
+    static constexpr uint32_t REPLACEMENT_CHARACTER = 0xFFFDu;
+
+    // Calls fn(codepoint) for each codepoint until fn returns false.
+    template <typename Fn>
+    static inline void forEachCodepoint(const char *data, size_t size, Fn &&fn)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+        const unsigned char *end = p + size;
+        while (p < end)
+        {
+            // ASCII fast path, 8 bytes per test
+            while (end - p >= 8)
+            {
+                uint64_t word;
+                std::memcpy(&word, p, sizeof(word));
+                if (word & 0x8080808080808080ull)
+                    break;
+                for (int i = 0; i < 8; ++i)
+                    if (!fn(static_cast<uint32_t>(p[i])))
+                        return;
+                p += 8;
+            }
+            if (p == end)
+                return;
+
+            uint32_t codepoint = *p;
+            if (codepoint < 0x80u)
+            {
+                p += 1;
+            }
+            else
+            {
+                size_t length;
+                uint32_t min;
+                if ((codepoint & 0xE0u) == 0xC0u)
+                    length = 2, min = 0x80u, codepoint &= 0x1Fu;
+                else if ((codepoint & 0xF0u) == 0xE0u)
+                    length = 3, min = 0x800u, codepoint &= 0x0Fu;
+                else if ((codepoint & 0xF8u) == 0xF0u)
+                    length = 4, min = 0x10000u, codepoint &= 0x07u;
+                else
+                    length = 0, min = 0;
+
+                bool valid = length != 0 && static_cast<size_t>(end - p) >= length;
+                for (size_t i = 1; valid && i < length; ++i)
+                {
+                    valid = (p[i] & 0xC0u) == 0x80u;
+                    codepoint = (codepoint << 6) | (p[i] & 0x3Fu);
+                }
+                valid = valid && codepoint >= min && codepoint <= 0x10FFFFu &&
+                        (codepoint < 0xD800u || codepoint > 0xDFFFu);
+                if (valid)
+                    p += length;
+                else
+                    codepoint = REPLACEMENT_CHARACTER, p += 1;
+            }
+            if (!fn(codepoint))
+                return;
+        }
+    }
+};
+
+#endif